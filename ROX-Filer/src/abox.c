@@ -669,7 +669,7 @@ void abox_set_file(ABox *abox, int i, const gchar *path)
 	diritem_free(item);
 }
 
-void    abox_set_percentage(ABox *abox, int per)
+static void abox_make_progress(ABox *abox)
 {
 	if(!abox->progress) {
 		GtkDialog *dialog = GTK_DIALOG(abox);
@@ -679,6 +679,11 @@ void    abox_set_percentage(ABox *abox, int per)
 				abox->progress, FALSE, FALSE, 2);
 		gtk_widget_show(abox->progress);
 	}
+}
+
+void    abox_set_percentage(ABox *abox, int per)
+{
+	abox_make_progress(abox);
 	if(per<0 || per>100) {
 		gtk_widget_hide(abox->progress);
 		return;
@@ -687,3 +692,51 @@ void    abox_set_percentage(ABox *abox, int per)
 				      per/100.);
 }
 
+/* Show how much of a copy, move or delete has been done. The bar shows
+ * the fraction of the bytes done (or of the files, if there are no bytes
+ * to count). 'rate' is in bytes per second.
+ */
+void	abox_set_progress(ABox *abox,
+			  unsigned long files_done, unsigned long files_total,
+			  double bytes_done, double bytes_total, double rate)
+{
+	GString	*text;
+	double	fraction = 1;
+
+	abox_make_progress(abox);
+
+	text = g_string_new(NULL);
+	g_string_printf(text, _("%lu of %lu files"), files_done, files_total);
+
+	if (bytes_total > 0)
+	{
+		gchar	*done;
+
+		fraction = bytes_done / bytes_total;
+
+		/* (format_double_size() reuses its buffer) */
+		done = g_strdup(format_double_size(bytes_done));
+		g_string_append(text, ", ");
+		g_string_append_printf(text, _("%s of %s"), done,
+				       format_double_size(bytes_total));
+		g_free(done);
+
+		if (rate > 0 && bytes_done < bytes_total)
+		{
+			long	left = (bytes_total - bytes_done) / rate;
+
+			g_string_append_printf(text, _(" (%s/s, %ld:%02ld left)"),
+					       format_double_size(rate),
+					       left / 60, left % 60);
+		}
+	}
+	else if (files_total > 0)
+		fraction = (double) files_done / files_total;
+
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(abox->progress),
+				      CLAMP(fraction, 0, 1));
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(abox->progress), text->str);
+	gtk_widget_show(abox->progress);
+
+	g_string_free(text, TRUE);
+}
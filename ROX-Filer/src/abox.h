@@ -84,5 +84,11 @@ void	abox_show_compare		(ABox *abox, gboolean show);
 void	abox_set_file			(ABox *abox, int file,
 					 const gchar *path);
 void    abox_set_percentage             (ABox *abox, int per);
+void	abox_set_progress		(ABox *abox,
+					 unsigned long files_done,
+					 unsigned long files_total,
+					 double bytes_done,
+					 double bytes_total,
+					 double rate);
 
 #endif /* __ABOX_H__ */
@@ -28,10 +28,12 @@
 #include <ctype.h>
 #include <sys/param.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/time.h>
 #include <utime.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "global.h"
 
@@ -61,6 +63,12 @@
 # define ATTR_MAN_PAGE N_("You do not appear to have OS support.")
 #endif 
 
+/* Seconds between progress reports while copying */
+#define PROGRESS_INTERVAL 0.2
+
+/* How many files may be waiting for each copy stream */
+#define COPY_QUEUE_PER_STREAM 4
+
 /* Parent->Child messages are one character each:
  *
  * Y/N 		Yes/No button clicked
@@ -68,9 +76,13 @@
  * Q		Quiet toggled
  * E		Entry text changed
  * W		neWer toggled
+ * C		full Copy toggled
  */
 
 typedef struct _GUIside GUIside;
+typedef struct _WorkDone WorkDone;
+typedef struct _CopyJob CopyJob;
+typedef struct _DirFixup DirFixup;
 typedef void ActionChild(gpointer data);
 typedef void ForDirCB(const char *path, const char *dest_path);
 
@@ -92,6 +104,34 @@ struct _GUIside
 	int		abort_attempts;
 };
 
+/* How much work should have been done after each item in a list */
+struct _WorkDone
+{
+	unsigned long	files;
+	double		bytes;
+};
+
+/* A file being copied by one of the copy streams */
+struct _CopyJob
+{
+	CopyJob		*next;		/* In copies_todo or copies_done */
+	gchar		*path;
+	gchar		*dest_path;
+	gboolean	clone;
+	int		item;		/* Index of the top-level item */
+	guchar		*error;		/* Set by the worker thread */
+};
+
+/* A directory we created, whose mode and times must be restored once
+ * everything inside it has been copied.
+ */
+struct _DirFixup
+{
+	gchar		*path;
+	mode_t		mode;
+	struct timespec	atime, mtime;
+};
+
 /* These don't need to be in a structure because we fork() before
  * using them again.
  */
@@ -108,6 +148,34 @@ static double	size_tally;		/* For Disk Usage */
 static unsigned long dir_counter;	/* For Disk Usage */
 static unsigned long file_counter;	/* For Disk Usage */
 
+/* For Copy, Move and Delete. The totals are found by count_work() */
+static unsigned long files_done, files_total;
+static double	bytes_done, bytes_total;
+
+/* For Copy, when copying several files at once (child only).
+ * The copy threads are plain pthreads, started after the fork. GLib's
+ * thread pools can't be used here, since their shared state is copied
+ * from the parent and refers to the parent's threads.
+ * copy_lock protects the job lists and streamed_bytes.
+ */
+static int	copy_streams = 0;	/* Threads started; 0 => one at a time */
+static pthread_mutex_t copy_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t copy_wanted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t copy_finished = PTHREAD_COND_INITIALIZER;
+static CopyJob	*copies_todo = NULL;	/* Waiting for a thread (a stack) */
+static CopyJob	*copies_done = NULL;	/* Finished, not yet reported */
+static int	copies_pending = 0;	/* Queued and not yet reported */
+static GList	*dir_fixups = NULL;	/* DirFixups, parents first */
+static double	streamed_bytes = 0;	/* Copied by workers, not reported */
+
+/* For reporting progress as each top-level item is finished, while
+ * the copies from later items are still going (see catch_up_items()).
+ */
+static WorkDone	*item_work = NULL;	/* Totals after each item */
+static int	*item_copies = NULL;	/* Copies pending for each item */
+static int	items_walked = 0;	/* Items given to action_do_func */
+static int	items_reported = 0;	/* Items passed to catch_up_work() */
+
 static struct mode_change *mode_change = NULL;	/* For Permissions */
 static FindCondition *find_condition = NULL;	/* For Find */
 static MIME_type *type_change = NULL;
@@ -117,11 +185,13 @@ static gboolean o_force = FALSE;
 static gboolean o_brief = FALSE;
 static gboolean o_recurse = FALSE;
 static gboolean o_newer = FALSE;
+static gboolean o_full_copy = FALSE;
 
 static Option o_action_copy, o_action_move, o_action_link;
 static Option o_action_delete, o_action_mount;
 static Option o_action_force, o_action_brief, o_action_recurse;
-static Option o_action_newer;
+static Option o_action_newer, o_action_full_copy;
+static Option o_action_copy_streams;
 
 static Option o_action_mount_command;
 static Option o_action_umount_command;
@@ -152,6 +222,28 @@ static void do_mount(const guchar *path, gboolean mount);
 static gboolean printf_reply(int fd, gboolean ignore_quiet,
 			     const char *msg, ...);
 static gboolean remove_pinned_ok(GList *paths);
+static void copy_progress(off_t bytes, gpointer data);
+static void send_progress(gboolean force);
+static void file_done(void);
+static WorkDone *count_work_list(GList *paths, gboolean bytes,
+				 const char *rename_dest);
+static void count_work(const char *path, gboolean bytes,
+		       const dev_t *rename_dev);
+static void catch_up_work(const WorkDone *work);
+static void catch_up_items(void);
+static void start_copy_streams(int streams);
+static void *copy_worker(void *data);
+static void stream_progress(off_t bytes, gpointer data);
+static void queue_copy(const char *path, const char *dest_path);
+static void collect_copies(gboolean block);
+static void finish_copies(void);
+static void restore_dir(const char *path, mode_t mode,
+			struct timespec atime, struct timespec mtime);
+static int rename_noreplace(const char *from, const char *to);
+static char *move_across_devices(const char *path, const char *dest_path,
+				 gboolean is_dir);
+static void move_finished(const char *path, const char *dest_path,
+			  gboolean is_dir, char *err);
 
 /*			SUPPORT				*/
 
@@ -381,6 +473,17 @@ static void process_message(GUIside *gui_side, const gchar *buffer)
 	{
 		abox_set_percentage(abox, atoi(buffer+1));
 	}
+	else if (*buffer == 'b')
+	{
+		unsigned long files_done, files_total;
+		double bytes_done, bytes_total, rate;
+
+		if (sscanf(buffer + 1, "%lu %lu %lf %lf %lf",
+			   &files_done, &files_total,
+			   &bytes_done, &bytes_total, &rate) == 5)
+			abox_set_progress(abox, files_done, files_total,
+					  bytes_done, bytes_total, rate);
+	}
 	else
 		abox_log(abox, buffer + 1, NULL);
 }
@@ -504,6 +607,372 @@ static void send_done(void)
 	printf_send(_("'\nDone\n"));
 }
 
+/* Tell the parent how far we've got and how fast we're going. Unless
+ * 'force' is set, this does nothing if we reported recently.
+ * The message is:
+ * b<files done> <files total> <bytes done> <bytes total> <bytes/second>
+ */
+static void send_progress(gboolean force)
+{
+	static GTimer	*timer = NULL;
+	static double	last_bytes = 0;
+	static double	rate = 0;
+	double		elapsed;
+
+	if (!timer)
+		timer = g_timer_new();
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	if (elapsed < PROGRESS_INTERVAL && !force)
+		return;
+
+	if (elapsed > 0)
+	{
+		double now = (bytes_done - last_bytes) / elapsed;
+
+		/* Smooth it a bit so the display doesn't jump around */
+		rate = rate ? (rate * 3 + now) / 4 : now;
+	}
+
+	printf_send("b%lu %lu %.0f %.0f %.0f", files_done, files_total,
+			bytes_done, bytes_total, rate);
+
+	last_bytes = bytes_done;
+	g_timer_start(timer);
+}
+
+/* Called by copy_file() as data is copied */
+static void copy_progress(off_t bytes, gpointer data)
+{
+	bytes_done += bytes;
+	send_progress(FALSE);
+}
+
+/* Called after each non-directory is copied or deleted */
+static void file_done(void)
+{
+	files_done++;
+	send_progress(FALSE);
+}
+
+/* Count the files (and their bytes, if 'bytes' is set) under each item
+ * in 'paths', setting files_total and bytes_total.
+ * If 'rename_dest' is set, we're moving the items there, and items already
+ * on that filesystem count as a single file, since they will be renamed.
+ * Returns an array with the running totals after each item. g_free() it.
+ */
+static WorkDone *count_work_list(GList *paths, gboolean bytes,
+				 const char *rename_dest)
+{
+	WorkDone	*work;
+	struct stat	info;
+	dev_t		dev;
+	int		i;
+
+	files_done = files_total = 0;
+	bytes_done = bytes_total = 0;
+
+	if (rename_dest && mc_stat(rename_dest, &info) == 0)
+		dev = info.st_dev;
+	else
+		rename_dest = NULL;
+
+	work = g_new(WorkDone, g_list_length(paths));
+
+	for (i = 0; paths; paths = paths->next, i++)
+	{
+		send_dir((char *) paths->data);
+		count_work((char *) paths->data, bytes,
+			   rename_dest ? &dev : NULL);
+		work[i].files = files_total;
+		work[i].bytes = bytes_total;
+	}
+
+	send_progress(TRUE);
+
+	return work;
+}
+
+/* Add 'path' (and everything inside it) to files_total and bytes_total.
+ * Errors are ignored; they will be reported when we try to do the work.
+ */
+static void count_work(const char *path, gboolean bytes,
+		       const dev_t *rename_dev)
+{
+	struct stat	info;
+	DIR		*d;
+	struct dirent	*ent;
+
+	if (mc_lstat(path, &info))
+		return;
+
+	if (rename_dev && info.st_dev == *rename_dev)
+	{
+		files_total++;
+		return;
+	}
+
+	if (!S_ISDIR(info.st_mode))
+	{
+		files_total++;
+		if (bytes && S_ISREG(info.st_mode))
+			bytes_total += info.st_size;
+		return;
+	}
+
+	d = mc_opendir(path);
+	if (!d)
+		return;
+
+	while ((ent = mc_readdir(d)))
+	{
+		gchar	*sub;
+
+		if (ent->d_name[0] == '.' && (ent->d_name[1] == '\0'
+			|| (ent->d_name[1] == '.' && ent->d_name[2] == '\0')))
+			continue;
+
+		sub = g_build_filename(path, ent->d_name, NULL);
+		count_work(sub, bytes, NULL);
+		g_free(sub);
+	}
+	mc_closedir(d);
+}
+
+/* An item has been dealt with. Anything inside it we didn't report
+ * on (eg, because it was renamed in one go, or there was an error) is
+ * now counted as done too.
+ */
+static void catch_up_work(const WorkDone *work)
+{
+	files_done = MAX(files_done, work->files);
+	bytes_done = MAX(bytes_done, work->bytes);
+	send_progress(FALSE);
+}
+
+/* Call catch_up_work() for each top-level item which has been walked
+ * and has no copies still pending, in order (the totals are cumulative,
+ * so an item can't be caught up before the ones in front of it).
+ */
+static void catch_up_items(void)
+{
+	if (!item_work)
+		return;
+
+	while (items_reported < items_walked &&
+	       item_copies[items_reported] == 0)
+		catch_up_work(&item_work[items_reported++]);
+}
+
+/* Copy regular files using 'streams' threads, instead of one at a time.
+ * The threads take files from a shared queue, which do_copy2() keeps
+ * topped up as it walks the tree. The threads last until the child exits.
+ */
+static void start_copy_streams(int streams)
+{
+	pthread_attr_t	attr;
+	pthread_t	thread;
+
+	if (copy_streams || streams < 2)
+		return;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* If we can't get them all, use what we've got. If none start,
+	 * copy_streams stays 0 and we copy one at a time.
+	 */
+	while (copy_streams < streams &&
+	       pthread_create(&thread, &attr, copy_worker, NULL) == 0)
+		copy_streams++;
+
+	pthread_attr_destroy(&attr);
+}
+
+/* Runs in a copy thread. The results are sent back to the main
+ * thread, which does all the talking to the parent.
+ */
+static void *copy_worker(void *data)
+{
+	while (1)
+	{
+		CopyJob	*job;
+
+		pthread_mutex_lock(&copy_lock);
+		while (!copies_todo)
+			pthread_cond_wait(&copy_wanted, &copy_lock);
+		job = copies_todo;
+		copies_todo = job->next;
+		pthread_mutex_unlock(&copy_lock);
+
+		job->error = copy_file(job->path, job->dest_path, job->clone,
+				       stream_progress, NULL);
+
+		pthread_mutex_lock(&copy_lock);
+		job->next = copies_done;
+		copies_done = job;
+		pthread_cond_signal(&copy_finished);
+		pthread_mutex_unlock(&copy_lock);
+	}
+
+	return NULL;
+}
+
+/* Called in the copy threads as data is copied */
+static void stream_progress(off_t bytes, gpointer data)
+{
+	pthread_mutex_lock(&copy_lock);
+	streamed_bytes += bytes;
+	pthread_mutex_unlock(&copy_lock);
+}
+
+/* Copy the regular file 'path' to 'dest_path' in the background. If
+ * the queue is full, wait for some of the earlier copies first.
+ */
+static void queue_copy(const char *path, const char *dest_path)
+{
+	CopyJob	*job;
+	int	max;
+
+	max = copy_streams * COPY_QUEUE_PER_STREAM;
+	while (copies_pending >= max)
+		collect_copies(TRUE);
+
+	job = g_new(CopyJob, 1);
+	job->path = g_strdup(path);
+	job->dest_path = g_strdup(dest_path);
+	job->clone = !o_full_copy;
+	job->item = items_walked;
+	job->error = NULL;
+
+	copies_pending++;
+	if (item_copies)
+		item_copies[job->item]++;
+	pthread_mutex_lock(&copy_lock);
+	job->next = copies_todo;
+	copies_todo = job;
+	pthread_cond_signal(&copy_wanted);
+	pthread_mutex_unlock(&copy_lock);
+
+	collect_copies(FALSE);
+}
+
+/* Report on any copies which have finished. If 'block' is set and none
+ * have, wait until one does (or until it's time to send a progress
+ * report anyway).
+ */
+static void collect_copies(gboolean block)
+{
+	CopyJob	*job, *next;
+	double	streamed;
+
+	pthread_mutex_lock(&copy_lock);
+	if (block && !copies_done)
+	{
+		struct timespec	end;
+		GTimeVal	now;
+
+		g_get_current_time(&now);
+		g_time_val_add(&now, PROGRESS_INTERVAL * G_USEC_PER_SEC);
+		end.tv_sec = now.tv_sec;
+		end.tv_nsec = now.tv_usec * 1000;
+		pthread_cond_timedwait(&copy_finished, &copy_lock, &end);
+	}
+	job = copies_done;
+	copies_done = NULL;
+	streamed = streamed_bytes;
+	streamed_bytes = 0;
+	pthread_mutex_unlock(&copy_lock);
+
+	for (; job; job = next)
+	{
+		next = job->next;
+
+		if (job->error)
+		{
+			printf_send(_("!%s\nFailed to copy '%s'\n"),
+					job->error, job->path);
+			g_free(job->error);
+		}
+		else
+			send_check_path(job->dest_path);
+
+		copies_pending--;
+		if (item_copies)
+			item_copies[job->item]--;
+		files_done++;
+
+		g_free(job->path);
+		g_free(job->dest_path);
+		g_free(job);
+	}
+
+	bytes_done += streamed;
+
+	send_progress(FALSE);
+	catch_up_items();
+}
+
+/* Wait for all the queued copies to finish, and then set the modes and
+ * times of the directories we created to hold them.
+ */
+static void finish_copies(void)
+{
+	GList	*next;
+
+	while (copies_pending)
+		collect_copies(TRUE);
+
+	/* do_copy2() adds a directory after its contents, so the list is
+	 * parent-first. Restore children first: once a parent has its
+	 * original mode, it may no longer let us search it (eg, mode 0600),
+	 * and then we couldn't reach the children to fix them.
+	 */
+	dir_fixups = g_list_reverse(dir_fixups);
+	for (next = dir_fixups; next; next = next->next)
+	{
+		DirFixup *fixup = (DirFixup *) next->data;
+
+		restore_dir(fixup->path, fixup->mode,
+			    fixup->atime, fixup->mtime);
+		g_free(fixup->path);
+		g_free(fixup);
+	}
+	g_list_free(dir_fixups);
+	dir_fixups = NULL;
+}
+
+/* Set the mode and times of a directory created by do_copy2() to match
+ * the original, once everything has been copied into it.
+ */
+static void restore_dir(const char *path, mode_t mode,
+			struct timespec atime, struct timespec mtime)
+{
+	struct timespec times[2];
+
+	/* We may have created the directory with
+	 * more permissions than the source so that
+	 * we could write to it... change it back now.
+	 */
+	if (chmod(path, mode))
+	{
+		/* Some filesystems don't support
+		 * SetGID and SetUID bits. Ignore
+		 * these errors.
+		 */
+		if (errno != EPERM)
+			send_error();
+	}
+
+	/* Also, try to preserve the timestamps (to the nanosecond,
+	 * like 'cp -p')
+	 */
+	times[0] = atime;
+	times[1] = mtime;
+
+	utimensat(AT_FDCWD, path, times, 0);
+}
+
 /* Notify the filer that this item has been updated */
 static void send_check_path(const gchar *path)
 {
@@ -635,6 +1104,9 @@ static void process_flag(char flag)
 	        case 'W':
 		        o_newer = !o_newer;
 			break;
+		case 'C':
+			o_full_copy = !o_full_copy;
+			break;
 		case 'E':
 			read_new_entry_text();
 			break;
@@ -802,6 +1274,7 @@ static GUIside *start_action(GtkWidget *abox, ActionChild *func, gpointer data,
 	o_brief = brief;
 	o_recurse = recurse;
 	o_newer = newer;
+	o_full_copy = o_action_full_copy.int_value;
 
 	child = fork();
 	switch (child)
@@ -952,18 +1425,22 @@ static void do_delete(const char *src_path, const char *unused)
 		printf_send(_("'Directory '%s' deleted\n"), safe_path);
 		send_mount_path(safe_path);
 	}
-	else if (unlink(src_path))
-		send_error();
 	else
 	{
-		send_check_path(safe_path);
-		if (strcmp(g_basename(safe_path), ".DirIcon") == 0)
+		if (unlink(src_path))
+			send_error();
+		else
 		{
-			gchar *dir;
-			dir = g_path_get_dirname(safe_path);
-			send_check_path(dir);
-			g_free(dir);
+			send_check_path(safe_path);
+			if (strcmp(g_basename(safe_path), ".DirIcon") == 0)
+			{
+				gchar *dir;
+				dir = g_path_get_dirname(safe_path);
+				send_check_path(dir);
+				g_free(dir);
+			}
 		}
+		file_done();
 	}
 
 	g_free(safe_path);
@@ -1400,30 +1877,23 @@ static void do_copy2(const char *path, const char *dest)
 			for_dir_contents(do_copy2, safe_path, safe_dest);
 			/* Note: dest_path now invalid... */
 
-			if (!exists)
+			if (!exists && copy_streams)
 			{
-				struct utimbuf utb;
+				DirFixup *fixup;
 
-				/* We may have created the directory with
-				 * more permissions than the source so that
-				 * we could write to it... change it back now.
+				/* Files may still be being copied into it.
+				 * Do this in finish_copies() instead.
 				 */
-				if (chmod(safe_dest, mode))
-				{
-					/* Some filesystems don't support
-					 * SetGID and SetUID bits. Ignore
-					 * these errors.
-					 */
-					if (errno != EPERM)
-						send_error();
-				}
-
-				/* Also, try to preserve the timestamps */
-				utb.actime = info.st_atime;
-				utb.modtime = info.st_mtime;
-
-				utime(safe_dest, &utb);
+				fixup = g_new(DirFixup, 1);
+				fixup->path = g_strdup(safe_dest);
+				fixup->mode = mode;
+				fixup->atime = info.st_atim;
+				fixup->mtime = info.st_mtim;
+				dir_fixups = g_list_prepend(dir_fixups, fixup);
 			}
+			else if (!exists)
+				restore_dir(safe_dest, mode,
+					    info.st_atim, info.st_mtim);
 		}
 
 		g_free(safe_path);
@@ -1449,12 +1919,17 @@ static void do_copy2(const char *path, const char *dest)
 		}
 		else
 			send_error();
+
+		file_done();
 	}
+	else if (copy_streams && S_ISREG(info.st_mode))
+		queue_copy(path, dest_path);
 	else
 	{
 		guchar	*error;
 
-		error = copy_file(path, dest_path);
+		error = copy_file(path, dest_path, !o_full_copy,
+				  copy_progress, NULL);
 
 		if (error)
 		{
@@ -1464,6 +1939,78 @@ static void do_copy2(const char *path, const char *dest)
 		}
 		else
 			send_check_path(dest_path);
+
+		file_done();
+	}
+}
+
+/* Like rename(), but fails with EEXIST rather than replacing 'to'.
+ * Where the kernel supports it, the check is atomic.
+ */
+static int rename_noreplace(const char *from, const char *to)
+{
+	struct stat info;
+
+#if defined(HAVE_RENAMEAT2) && defined(RENAME_NOREPLACE)
+	if (renameat2(AT_FDCWD, from, AT_FDCWD, to, RENAME_NOREPLACE) == 0)
+		return 0;
+	if (errno != EINVAL && errno != ENOSYS)
+		return -1;
+	/* Filesystem doesn't support the flag... check ourselves */
+#endif
+	if (mc_lstat(to, &info) == 0)
+	{
+		errno = EEXIST;
+		return -1;
+	}
+
+	return rename(from, to);
+}
+
+/* rename() can't move things between filesystems, so copy 'path' to
+ * 'dest_path' and then remove the original. Directories are passed to
+ * mv(1). Returns an error string, or NULL on success. g_free() the result.
+ */
+static char *move_across_devices(const char *path, const char *dest_path,
+				 gboolean is_dir)
+{
+	char	*err;
+
+	if (is_dir)
+	{
+		const char *argv[] = {"mv", "-f", NULL, NULL, NULL};
+
+		argv[2] = path;
+		argv[3] = dest_path;
+
+		return fork_exec_wait(argv);
+	}
+
+	err = copy_file(path, dest_path, !o_full_copy, copy_progress, NULL);
+	if (!err && unlink(path))
+		err = g_strdup(g_strerror(errno));
+
+	return err;
+}
+
+/* Report the result of moving 'path' to 'dest_path'. Frees 'err'. */
+static void move_finished(const char *path, const char *dest_path,
+			  gboolean is_dir, char *err)
+{
+	if (err)
+	{
+		printf_send(_("!%s\nFailed to move %s as %s\n"),
+			    err, path, dest_path);
+		g_free(err);
+	}
+	else
+	{
+		send_check_path(dest_path);
+
+		if (is_dir)
+			send_mount_path(path);
+		else
+			send_check_path(path);
 	}
 }
 
@@ -1471,10 +2018,8 @@ static void do_copy2(const char *path, const char *dest)
 static void do_move2(const char *path, const char *dest)
 {
 	const char	*dest_path;
-	const char	*argv[] = {"mv", "-f", NULL, NULL, NULL};
-	struct stat	info2;
+	struct stat	info, info2;
 	gboolean	is_dir;
-	char            *err;
 
 	check_flags();
 
@@ -1482,31 +2027,65 @@ static void do_move2(const char *path, const char *dest)
 
 	is_dir = mc_lstat(path, &info2) == 0 && S_ISDIR(info2.st_mode);
 
-	if (access(dest_path, F_OK) == 0)
+	if (mc_lstat(dest_path, &info))
 	{
-		struct stat	info;
-		int		err;
+		if (!quiet)
+		{
+			printf_send("<%s", path);
+			printf_send(">");
+			if (!printf_reply(from_parent, FALSE,
+					  _("?Move %s as %s?"), path, dest_path))
+				return;
+		}
+		else if (!o_brief)
+			printf_send(_("'Moving %s as %s\n"), path, dest_path);
 
-		if (mc_lstat(dest_path, &info))
+		if (rename_noreplace(path, dest_path) == 0)
 		{
-			send_error();
+			move_finished(path, dest_path, is_dir, NULL);
 			return;
 		}
 
-		if (!is_dir && o_newer && info2.st_mtime > info.st_mtime)
+		if (errno == EXDEV)
 		{
-			/* Newer; keep going */
+			move_finished(path, dest_path, is_dir,
+				move_across_devices(path, dest_path, is_dir));
+			return;
 		}
-		else
+
+		if (errno != EEXIST || mc_lstat(dest_path, &info))
 		{
-			printf_send("<%s", path);
-			printf_send(">%s", dest_path);
-			if (!printf_reply(from_parent, TRUE,
-				       _("?'%s' already exists - overwrite?"),
-				       dest_path))
-				return;
+			move_finished(path, dest_path, is_dir,
+				      g_strdup(g_strerror(errno)));
+			return;
 		}
 
+		/* Something was created there while we were asking... */
+	}
+
+	if (!is_dir && o_newer && info2.st_mtime > info.st_mtime)
+	{
+		/* Newer; keep going */
+	}
+	else
+	{
+		printf_send("<%s", path);
+		printf_send(">%s", dest_path);
+		if (!printf_reply(from_parent, TRUE,
+			       _("?'%s' already exists - overwrite?"),
+			       dest_path))
+			return;
+	}
+
+	/* rename() replaces files and empty directories atomically, but
+	 * not one with the other. mv(1) won't replace directories when
+	 * moving between filesystems.
+	 */
+	if (S_ISDIR(info.st_mode) != is_dir ||
+	    (is_dir && info.st_dev != info2.st_dev))
+	{
+		int	err;
+
 		if (S_ISDIR(info.st_mode))
 			err = rmdir(dest_path);
 		else
@@ -1520,36 +2099,15 @@ static void do_move2(const char *path, const char *dest)
 			printf_send(_("'Trying move anyway...\n"));
 		}
 	}
-	else if (!quiet)
-	{
-		printf_send("<%s", path);
-		printf_send(">");
-		if (!printf_reply(from_parent, FALSE,
-				  _("?Move %s as %s?"), path, dest_path))
-			return;
-	}
-	else if (!o_brief)
-		printf_send(_("'Moving %s as %s\n"), path, dest_path);
 
-	argv[2] = path;
-	argv[3] = dest_path;
-
-	err = fork_exec_wait(argv);
-	if (err)
-	{
-		printf_send(_("!%s\nFailed to move %s as %s\n"),
-			    err, path, dest_path);
-		g_free(err);
-	}
+	if (rename(path, dest_path) == 0)
+		move_finished(path, dest_path, is_dir, NULL);
+	else if (errno == EXDEV)
+		move_finished(path, dest_path, is_dir,
+			      move_across_devices(path, dest_path, is_dir));
 	else
-	{
-		send_check_path(dest_path);
-
-		if (is_dir)
-			send_mount_path(path);
-		else
-			send_check_path(path);
-	}
+		move_finished(path, dest_path, is_dir,
+			      g_strdup(g_strerror(errno)));
 }
 
 /* Copy path to dest.
@@ -1790,9 +2348,11 @@ static guchar *dirname(guchar *path)
 static void delete_cb(gpointer data)
 {
 	GList	*paths = (GList *) data;
-	int n, i, per;
+	WorkDone *work;
+	int i;
+
+	work = count_work_list(paths, FALSE, NULL);
 
-	n=g_list_length(paths);
 	for (i=0; paths; paths = paths->next, i++)
 	{
 		guchar	*path = (guchar *) paths->data;
@@ -1801,16 +2361,14 @@ static void delete_cb(gpointer data)
 		dir = dirname(path);
 		send_dir(dir);
 
-		if(n>1 && i>0)
-		{
-			per=100*i/n;
-			printf_send("%%%d", per);
-		}
 		do_delete(path, dir);
+		catch_up_work(&work[i]);
 
 		g_free(dir);
 	}
 	
+	g_free(work);
+	send_progress(TRUE);
 	send_done();
 }
 
@@ -1928,13 +2486,32 @@ static void settype_cb(gpointer data)
 static void list_cb(gpointer data)
 {
 	GList	*paths = (GList *) data;
+	WorkDone *work = NULL;
 	int n, i, per;
 
 	n=g_list_length(paths);
 
+	/* Linking is quick; count the rest first so we can show progress */
+	if (action_do_func == do_copy)
+	{
+		work = count_work_list(paths, TRUE, NULL);
+		start_copy_streams(o_action_copy_streams.int_value);
+	}
+	else if (action_do_func == do_move)
+		work = count_work_list(paths, TRUE, action_dest);
+
+	if (work)
+	{
+		item_work = work;
+		item_copies = g_new0(int, n);
+	}
+
+	/* (with copy streams, the items' copies overlap; each item is
+	 * reported as done once its last copy finishes)
+	 */
 	for (i=0; paths; paths = paths->next, i++)
 	{
-		if(n>1 && i>0)
+		if(n>1 && i>0 && !work)
 		{
 			per=100*i/n;
 			printf_send("%%%d", per);
@@ -1942,8 +2519,21 @@ static void list_cb(gpointer data)
 		send_dir((char *) paths->data);
 
 		action_do_func((char *) paths->data, action_dest);
+
+		items_walked = i + 1;
+		catch_up_items();
 	}
 
+	finish_copies();
+
+	if (work)
+	{
+		catch_up_items();
+		item_work = NULL;
+		null_g_free(&item_copies);
+		g_free(work);
+		send_progress(TRUE);
+	}
 	send_done();
 }
 
@@ -2282,6 +2872,11 @@ void action_copy(GList *paths, const char *dest, const char *leaf, int quiet)
 	abox_add_flag(ABOX(abox),
 		_("Brief"), _("Only log directories as they are copied"),
 		'B', o_action_brief.int_value);
+	abox_add_flag(ABOX(abox),
+		_("Full copy"),
+		_("Always copy the data, even if the filesystem could share "
+		  "it between the original and the copy."),
+		'C', o_action_full_copy.int_value);
 
 	log_info_paths_leaf("Copy", paths, dest, leaf);
 
@@ -2394,6 +2989,8 @@ void action_init(void)
 	option_add_int(&o_action_brief, "action_brief", FALSE);
 	option_add_int(&o_action_recurse, "action_recurse", FALSE);
 	option_add_int(&o_action_newer, "action_newer", FALSE);
+	option_add_int(&o_action_full_copy, "action_full_copy", FALSE);
+	option_add_int(&o_action_copy_streams, "action_copy_streams", 1);
 
 	option_add_string(&o_action_mount_command,
 			  "action_mount_command", "mount");
@@ -31,6 +31,7 @@
 #include "global.h"
 
 #include "collection.h"
+#include "support.h"
 
 #define MIN_WIDTH 80
 #define MIN_HEIGHT 60
@@ -123,7 +124,6 @@ static void remove_lasso_box(Collection *collection);
 static void draw_lasso_box(Collection *collection);
 static void cancel_wink(Collection *collection);
 static gint collection_key_press(GtkWidget *widget, GdkEventKey *event);
-static void get_visible_limits(Collection *collection, int *first, int *last);
 static void scroll_to_show(Collection *collection, int item);
 static void collection_item_set_selected(Collection *collection,
                                          gint item,
@@ -474,7 +474,7 @@ static void collection_size_allocate(GtkWidget *widget,
 		collection_item_to_rowcol(collection, collection->cursor_item,
 					  &crow, &ccol);
 
-		get_visible_limits(collection, &first, &last);
+		collection_get_visible_limits(collection, &first, &last);
 
 		cursor_visible = crow >= first && crow <= last;
 	}
@@ -746,14 +746,14 @@ static gint collection_key_press(GtkWidget *widget, GdkEventKey *event)
 		case GDK_Page_Up:
 		  {
 		        int first, last;
-		       	get_visible_limits(collection, &first, &last);
+		       	collection_get_visible_limits(collection, &first, &last);
 			collection_move_cursor(collection, first - last - 1, 0);
 			break;
 		  }
 		case GDK_Page_Down:
 		  {
 		        int first, last;
-		       	get_visible_limits(collection, &first, &last);
+		       	collection_get_visible_limits(collection, &first, &last);
 			collection_move_cursor(collection, last - first + 1, 0);
 			break;
 		  }
@@ -1006,7 +1006,7 @@ static void scroll_to_show(Collection *collection, int item)
 	g_return_if_fail(IS_COLLECTION(collection));
 
 	collection_item_to_rowcol(collection, item, &row, &col);
-	get_visible_limits(collection, &first, &last);
+	collection_get_visible_limits(collection, &first, &last);
 
 	if (row <= first)
 	{
@@ -1030,7 +1030,8 @@ static void scroll_to_show(Collection *collection, int item)
 /* Return the first and last rows which are [partly] visible. Does not
  * ensure that the rows actually exist (contain items).
  */
-static void get_visible_limits(Collection *collection, int *first, int *last)
+void collection_get_visible_limits(Collection *collection,
+				   int *first, int *last)
 {
 	GtkWidget	*widget = (GtkWidget *) collection;
 	gint		scroll = 0, height;
@@ -1376,12 +1377,12 @@ void collection_set_item_size(Collection *collection, int width, int height)
 }
 
 static int (*cmp_callback)(const void *a, const void *b) = NULL;
-static int collection_cmp(const void *a, const void *b)
+static int collection_cmp(const void *a, const void *b, gpointer data)
 {
 	return cmp_callback(((CollectionItem *) a)->data,
 			    ((CollectionItem *) b)->data);
 }
-static int collection_rcmp(const void *a, const void *b)
+static int collection_rcmp(const void *a, const void *b, gpointer data)
 {
 	return -cmp_callback(((CollectionItem *) a)->data,
 			     ((CollectionItem *) b)->data);
@@ -1393,6 +1394,17 @@ static int collection_rcmp(const void *a, const void *b)
 void collection_qsort(Collection *collection,
 		      int (*compar)(const void *, const void *),
 		      GtkSortType order)
+{
+	collection_sort_added(collection, compar, order, 0);
+}
+
+/* As collection_qsort(), but the first 'old_items' are known to be in
+ * order already (eg, items have just been added to a sorted collection).
+ * Only the new items are sorted, and are then merged in.
+ */
+void collection_sort_added(Collection *collection,
+			   int (*compar)(const void *, const void *),
+			   GtkSortType order, int old_items)
 {
 	int	cursor, wink, items, wink_on_map;
 	gpointer cursor_data = NULL;
@@ -1412,7 +1424,7 @@ void collection_qsort(Collection *collection,
 		return;
 
 	array = collection->items;
-	for (i = 1; i < collection->number_of_items; i++)
+	for (i = MAX(old_items, 1); i < collection->number_of_items; i++)
 	{
 		if (mul * compar(array[i - 1].data, array[i].data) > 0)
 			break;
@@ -1447,9 +1459,9 @@ void collection_qsort(Collection *collection,
 		cursor = -1;
 	
 	cmp_callback = compar;
-	qsort(collection->items, items, sizeof(collection->items[0]),
+	sort_appended(collection->items, items, i, sizeof(collection->items[0]),
 			order == GTK_SORT_ASCENDING ? collection_cmp
-						    : collection_rcmp);
+						    : collection_rcmp, NULL);
 	cmp_callback = NULL;
 
 	if (cursor > -1 || wink > -1 || wink_on_map > -1)
@@ -1720,7 +1732,7 @@ void collection_move_cursor(Collection *collection, int drow, int dcol)
 		return;
 	}
 
-	get_visible_limits(collection, &first, &last);
+	collection_get_visible_limits(collection, &first, &last);
 	total_rows = collection_get_rows(collection);
 	total_cols = collection_get_cols(collection);
 
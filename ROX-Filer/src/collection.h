@@ -133,6 +133,10 @@ void 	collection_qsort		(Collection *collection,
 					 int (*compar)(const void *,
 						       const void *),
 					 GtkSortType order);
+void 	collection_sort_added		(Collection *collection,
+					 int (*compar)(const void *,
+						       const void *),
+					 GtkSortType order, int old_items);
 int 	collection_find_item		(Collection *collection,
 					 gpointer data,
 					 int (*compar)(const void *,
@@ -160,6 +164,8 @@ void    collection_item_to_rowcol       (const Collection *collection,
 					 int item, int *row, int *col);
 int     collection_rowcol_to_item       (const Collection *collection,
 					 int row, int col);
+void	collection_get_visible_limits	(Collection *collection,
+					 int *first, int *last);
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -53,29 +53,139 @@
 #include <gtk/gtk.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "global.h"
 
 #include "dir.h"
 #include "diritem.h"
+#include "dirsnap.h"
 #include "support.h"
 #include "gui_support.h"
 #include "dir.h"
 #include "fscache.h"
 #include "mount.h"
+#include "options.h"
 #include "pixmaps.h"
 #include "type.h"
 #include "usericons.h"
 #include "main.h"
 
-#ifdef USE_NOTIFY
+/* How long (in seconds) recheck_callback() may spend restatting items
+ * before returning to the main loop. Items are restatted in batches
+ * rather than one per idle call, so that large directories on slow
+ * filesystems don't need one main loop iteration per item.
+ */
+#define RECHECK_TIME_BUDGET 0.02
+
+/* When threads are available, queued items are restatted by a pool of
+ * worker threads instead, so that a slow file (e.g. one on a network
+ * mount, or one needing its contents sniffed to get its MIME type)
+ * doesn't hold up the rest. The results are applied in the main thread.
+ */
+#define RESTAT_THREADS 4
+
+/* Max items per directory passed to the workers at once. The rest stay
+ * on the recheck_list, so that a rescan doesn't have to wait for
+ * thousands of stale jobs to drain.
+ */
+#define RESTAT_QUEUE_SIZE 256
+
+/* Files being written to are restatted at most once per this many ms,
+ * however many IN_MODIFY events they generate.
+ */
+#define CHANGED_RESTAT_INTERVAL 1000
+
+/* The inotify watch limit (fs.inotify.max_user_watches) is shared by all
+ * of the user's programs, so we only use this fraction of it ourselves.
+ * Directories beyond that are polled every POLL_INTERVAL ms instead.
+ */
+#define WATCH_BUDGET_DIVISOR 4
+#define DEFAULT_MAX_WATCHES 8192
+#define POLL_INTERVAL 5000
+
+/* Mount points may be on filesystems which are slow, or hung (a dead NFS
+ * server, say), so they are restatted by their own threads (see
+ * queue_mount_restat()). If one takes longer than this many ms, its item
+ * is shown as a placeholder until the results arrive.
+ */
+#define MOUNT_RESTAT_DEADLINE 1000
+
+/* An open directory, shared between the Directory and any restat jobs
+ * using it. Only referenced and unreferenced in the main thread.
+ */
+struct _ScanFD {
+	int	fd;
+	int	ref;
+};
+
+typedef struct _RestatJob RestatJob;
+
+struct _RestatJob {
+	Directory	*dir;
+	gint		generation;	/* dir->scan_generation when queued */
+	gchar		*leafname;
+	gchar		*path;
+	ScanFD		*scan_fd;	/* NULL => stat by path */
+	struct stat	parent;
+	DirItemStat	st;		/* Filled in by the worker */
+
+	/* Mount points only; see queue_mount_restat() */
+	gboolean	mount;
+	gdouble		started;
+};
+
+typedef struct _MountDeadline MountDeadline;
+
+struct _MountDeadline {
+	Directory	*dir;
+	gchar		*leafname;
+};
+
+static GThreadPool *restat_pool = NULL;	/* NULL => restat in main thread */
+
+/* Restats mount points, with no limit on the number of threads, so that
+ * one hung filesystem never holds up the others. NULL if no threads.
+ */
+static GThreadPool *mount_pool = NULL;
+
+/* Finished RestatJobs, waiting for restat_jobs_done() */
+G_LOCK_DEFINE_STATIC(restat_done);
+static GList *restat_done = NULL;
+static guint restat_done_idle = 0;
+
+#ifdef USE_DNOTIFY
 static GHashTable *notify_fd_to_dir = NULL;
 #endif
 #ifdef USE_INOTIFY
 # include <sys/inotify.h>
 GIOChannel *inotify_channel;
 static int inotify_fd;
+
+/* The kernel gives each inode one watch descriptor, however many paths
+ * it is watched by. A Watch records which Directories share one, so that
+ * it is only removed when the last of them is detached.
+ */
+typedef struct _Watch Watch;
+
+struct _Watch
+{
+	int	wd;
+	GList	*dirs;
+};
+
+static GHashTable *watches = NULL;	/* wd -> Watch */
+static guint watch_budget = 0;		/* Max size of watches */
+
+/* Attached Directories with no watch, checked every POLL_INTERVAL */
+static GList *polled_dirs = NULL;
+static guint poll_timeout = 0;
+
+/* Pathname -> Directory, for each directory with an inotify watch. Files
+ * in these don't need to be stat()ed to check that GFSCaches are up-to-date.
+ */
+static GHashTable *watched_dirs = NULL;
 #endif
 #ifdef USE_DNOTIFY
 /* Newer Linux kernels can tell us when the directories we are watching
@@ -91,9 +201,15 @@ static int in_callback = 0;
 GFSCache *dir_cache = NULL;
 
 /* Static prototypes */
+static void add_item_size(gpointer key, gpointer value, gpointer data);
+static void drop_collate(gpointer key, gpointer value, gpointer data);
+static void set_pathname(Directory *dir, gchar *pathname);
 static void update(Directory *dir, gchar *pathname, gpointer data);
 static void set_idle_callback(Directory *dir);
-static DirItem *insert_item(Directory *dir, const guchar *leafname);
+static DirItem *insert_item(Directory *dir, const guchar *leafname,
+			     DirItemStat *st);
+static void restat_item(Directory *dir, const gchar *full_path,
+			DirItem *item, DirItemStat *st);
 static void remove_missing(Directory *dir, GPtrArray *keep);
 static void dir_recheck(Directory *dir,
 			const guchar *path, const guchar *leafname);
@@ -101,11 +217,41 @@ static GPtrArray *hash_to_array(GHashTable *hash);
 static void dir_force_update_item(Directory *dir, const gchar *leaf);
 static Directory *dir_new(const char *pathname);
 static void dir_rescan(Directory *dir);
+static void open_scan_fd(Directory *dir);
+static void close_scan_fd(Directory *dir);
+static void scan_fd_unref(ScanFD *scan_fd);
+static void scan_finished(Directory *dir);
+static void load_snapshot(Directory *dir);
+static void queue_restat(Directory *dir, gchar *leafname);
+static void restat_worker(gpointer data, gpointer user_data);
+static gboolean restat_jobs_done(gpointer data);
+static gboolean restat_mount_async(const gchar *path);
+static void queue_mount_restat(Directory *dir, gchar *leafname);
+static gboolean mount_deadline(gpointer data);
+static void show_mount_pending(Directory *dir, const gchar *leafname);
+static void delayed_notify(Directory *dir);
 #ifdef USE_NOTIFY
 static void dir_rescan_soon(Directory *dir);
 # ifdef USE_INOTIFY
 static gboolean inotify_handler(GIOChannel *source, GIOCondition condition,
 			    gpointer udata);
+static gboolean dir_path_watched(const char *path);
+static void inotify_file_event(Directory *dir, struct inotify_event *event);
+static void rescan_watched(gpointer key, gpointer value, gpointer data);
+static void item_written(Directory *dir, const gchar *leafname);
+static gboolean restat_changed(gpointer data);
+static void cancel_changed(Directory *dir);
+static void watch_dir(Directory *dir);
+static void unwatch_dir(Directory *dir);
+static gboolean add_watch(Directory *dir);
+static void forget_watch(Watch *watch, gboolean remove);
+static gboolean evict_watch(void);
+static void promote_polled(void);
+static void start_polling(Directory *dir);
+static gboolean poll_dirs(gpointer data);
+static void poll_dir(Directory *dir);
+static gint cmp_viewed(gconstpointer a, gconstpointer b, gpointer data);
+static guint read_watch_budget(void);
 # else
 static void dnotify_handler(int sig, siginfo_t *si, void *data);
 # endif
@@ -120,16 +266,29 @@ void dir_init(void)
 	dir_cache = g_fscache_new((GFSLoadFunc) dir_new,
 				(GFSUpdateFunc) update, NULL);
 
-#ifdef USE_NOTIFY
-	notify_fd_to_dir = g_hash_table_new(NULL, NULL);
+	if (g_thread_supported())
+	{
+		restat_pool = g_thread_pool_new(restat_worker, NULL,
+						RESTAT_THREADS, FALSE, NULL);
+		mount_pool = g_thread_pool_new(restat_worker, NULL,
+					       -1, FALSE, NULL);
+	}
 
+#ifdef USE_NOTIFY
 # ifdef USE_INOTIFY
 	inotify_fd = inotify_init();
 	inotify_channel = g_io_channel_unix_new(inotify_fd);
 	g_io_add_watch(inotify_channel, G_IO_IN, inotify_handler, NULL);
+
+	watches = g_hash_table_new(NULL, NULL);
+	watch_budget = read_watch_budget();
+	watched_dirs = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, NULL);
+	g_fscache_set_watched_func(dir_path_watched);
 # endif
 	
 # ifdef USE_DNOTIFY
+	notify_fd_to_dir = g_hash_table_new(NULL, NULL);
 	{
 		struct sigaction act;
 
@@ -172,28 +331,9 @@ void dir_attach(Directory *dir, DirCallback callback, gpointer data)
 	user->data = data;
 
 #ifdef USE_INOTIFY
+	dir->last_viewed = time(NULL);
 	if (!dir->users)
-	{
-		int fd;
-
-		if (dir->notify_fd != -1)
-			g_warning("dir_attach: inotify error\n");
-
-		fd = inotify_add_watch( inotify_fd,
-					dir->pathname,
-					IN_CREATE | IN_DELETE | IN_MOVE |
-					IN_ATTRIB); 
-		
-		g_return_if_fail(g_hash_table_lookup(notify_fd_to_dir,
-						 GINT_TO_POINTER(fd)) == NULL);
-		if (fd != -1)
-		{
-		  
-			dir->notify_fd = fd;
-			g_hash_table_insert(notify_fd_to_dir,
-					    GINT_TO_POINTER(fd), dir);
-		}
-	}
+		watch_dir(dir);
 #endif
 #ifdef USE_DNOTIFY
 	if (!dir->users)
@@ -217,11 +357,21 @@ void dir_attach(Directory *dir, DirCallback callback, gpointer data)
 		}
 	}
 #endif
-	
+
+	/* insert_item() puts new items in known_items straight away, so
+	 * send any that haven't been merged yet to the existing users now.
+	 * Otherwise, we'd give them to the new user twice (once below and
+	 * again as DIR_ADD when they're merged).
+	 */
+	dir_merge_new(dir);
+
 	dir->users = g_list_prepend(dir->users, user);
 
 	g_object_ref(dir);
 
+	if (!dir->have_scanned && g_hash_table_size(dir->known_items) == 0)
+		load_snapshot(dir);
+
 	items = hash_to_array(dir->known_items);
 	if (items->len)
 		callback(dir, DIR_ADD, items, data);
@@ -261,22 +411,30 @@ void dir_detach(Directory *dir, DirCallback callback, gpointer data)
 			/* May stop scanning if noone's watching */
 			set_idle_callback(dir);
 
-#ifdef USE_NOTIFY
+			/* Collate keys are only needed for sorting views */
+			if (!dir->users)
+				g_hash_table_foreach(dir->known_items,
+						     drop_collate, NULL);
+
+#ifdef USE_DNOTIFY
 			if (!dir->users && dir->notify_fd != -1)
 			{
-# ifdef USE_DNOTIFY
 				close(dir->notify_fd);
-# endif
 				g_hash_table_remove(notify_fd_to_dir,
 					GINT_TO_POINTER(dir->notify_fd));
 				dir->notify_fd = -1;
 			}
-# ifdef USE_INOTIFY
+#endif
+#ifdef USE_INOTIFY
 			if (dir->inotify_source) {
 				g_source_remove(dir->inotify_source);
 				dir->inotify_source = 0;
 			}
-# endif
+			if (!dir->users)
+			{
+				unwatch_dir(dir);
+				cancel_changed(dir);
+			}
 #endif
 			return;
 		}
@@ -320,15 +478,10 @@ void dir_check_this(const guchar *path)
 	g_free(real_path);
 }
 
-#ifdef USE_NOTIFY
+#ifdef USE_DNOTIFY
 static void drop_notify(gpointer key, gpointer value, gpointer data)
 {
-#ifdef USE_INOTIFY
-        inotify_rm_watch(inotify_fd, GPOINTER_TO_INT(key));
-#endif
-#ifdef USE_DNOTIFY
 	close(GPOINTER_TO_INT(key));
-#endif
 }
 #endif
 
@@ -366,6 +519,75 @@ void dir_force_update_path(const gchar *path)
 	g_free(dir_path);
 }
 
+/* If the directory 'path' is loaded, set 'n_items' to the number of items
+ * in it and 'bytes' to the memory they use, and return TRUE.
+ */
+gboolean dir_memory_usage(const gchar *path, guint *n_items, gsize *bytes)
+{
+	Directory *dir;
+
+	dir = g_fscache_lookup_full(dir_cache, path, FSCACHE_LOOKUP_PEEK,
+			NULL);
+	if (!dir)
+		return FALSE;
+
+	*n_items = g_hash_table_size(dir->known_items);
+	*bytes = 0;
+	g_hash_table_foreach(dir->known_items, add_item_size, bytes);
+	g_object_unref(dir);
+
+	return TRUE;
+}
+
+/* Set 'used' to the number of inotify watches we have and 'budget' to the
+ * most we will use. Returns the paths of attached directories which are
+ * being polled instead, most recently viewed first.
+ * g_free() each path and g_list_free() the list.
+ */
+GList *dir_watch_usage(guint *used, guint *budget)
+{
+	GList	*paths = NULL;
+#ifdef USE_INOTIFY
+	GList	*next;
+
+	*used = g_hash_table_size(watches);
+	*budget = watch_budget;
+
+	for (next = polled_dirs; next; next = next->next)
+	{
+		Directory *dir = (Directory *) next->data;
+
+		paths = g_list_insert_sorted_with_data(paths, dir,
+					cmp_viewed, NULL);
+	}
+	for (next = paths; next; next = next->next)
+		next->data = g_strdup(((Directory *) next->data)->pathname);
+#else
+	*used = *budget = 0;
+#endif
+
+	return paths;
+}
+
+/* TRUE if 'path' is loaded and being polled for changes (see above) */
+gboolean dir_is_polled(const gchar *path)
+{
+	gboolean polled = FALSE;
+#ifdef USE_INOTIFY
+	Directory *dir;
+
+	dir = g_fscache_lookup_full(dir_cache, path, FSCACHE_LOOKUP_PEEK,
+			NULL);
+	if (dir)
+	{
+		polled = dir->polled;
+		g_object_unref(dir);
+	}
+#endif
+
+	return polled;
+}
+
 /* Ensure that 'leafname' is up-to-date. Returns the new/updated
  * DirItem, or NULL if the file no longer exists.
  */
@@ -374,7 +596,7 @@ DirItem *dir_update_item(Directory *dir, const gchar *leafname)
 	DirItem *item;
 	
 	time(&diritem_recent_time);
-	item = insert_item(dir, leafname);
+	item = insert_item(dir, leafname, NULL);
 	dir_merge_new(dir);
 
 	return item;
@@ -458,42 +680,304 @@ static gboolean recheck_callback(gpointer data)
 	Directory *dir = (Directory *) data;
 	GList	*next;
 	guchar	*leaf;
+	static GTimer *timer = NULL;
 	
 	g_return_val_if_fail(dir != NULL, FALSE);
 	g_return_val_if_fail(dir->recheck_list != NULL, FALSE);
 
-	/* Remove the first name from the list */
-	next = dir->recheck_list;
-	dir->recheck_list = g_list_remove_link(dir->recheck_list, next);
-	leaf = (guchar *) next->data;
-	g_list_free_1(next);
+	if (!timer)
+		timer = g_timer_new();
+	g_timer_start(timer);
 
-	/* usleep(800); */
+	open_scan_fd(dir);
 
-	insert_item(dir, leaf);
+	if (restat_pool)
+	{
+		/* Hand the items over to the worker threads. We get called
+		 * again by restat_jobs_done() when there's room for more.
+		 */
+		while (dir->recheck_list &&
+		       dir->restat_pending < RESTAT_QUEUE_SIZE)
+		{
+			next = dir->recheck_list;
+			dir->recheck_list = g_list_remove_link(
+						dir->recheck_list, next);
+			queue_restat(dir, (gchar *) next->data);
+			g_list_free_1(next);
+		}
 
-	g_free(leaf);
+		g_source_remove(dir->idle_callback);
+		dir->idle_callback = 0;
+		return FALSE;
+	}
+
+	do
+	{
+		/* Remove the first name from the list */
+		next = dir->recheck_list;
+		dir->recheck_list = g_list_remove_link(dir->recheck_list, next);
+		leaf = (guchar *) next->data;
+		g_list_free_1(next);
+
+		/* usleep(800); */
+
+		insert_item(dir, leaf, NULL);
+
+		g_free(leaf);
+	} while (dir->recheck_list &&
+		 g_timer_elapsed(timer, NULL) < RECHECK_TIME_BUDGET);
 
 	if (dir->recheck_list)
 		return TRUE;	/* Call again */
 
-	/* The recheck_list list empty. Stop scanning, unless
-	 * needs_update, in which case we start scanning again.
-	 */
+	g_source_remove(dir->idle_callback);
+	dir->idle_callback = 0;
+	scan_finished(dir);
 
+	return FALSE;
+}
+
+/* The recheck_list is empty and no items are still being restatted.
+ * Stop scanning, unless needs_update, in which case we start scanning
+ * again.
+ */
+static void scan_finished(Directory *dir)
+{
 	dir_merge_new(dir);
 	
 	dir->have_scanned = TRUE;
 	dir_set_scanning(dir, FALSE);
-	g_source_remove(dir->idle_callback);
-	dir->idle_callback = 0;
+	close_scan_fd(dir);
 
 	if (dir->needs_update)
 		dir_rescan(dir);
+	else if (!dir->error)
+		dirsnap_save(dir->pathname, &dir->stat_info, dir->known_items);
+}
+
+/* Fill a new Directory with the items saved last time it was scanned,
+ * if any, so that they can be shown before the scan has finished.
+ * The scan will still restat them all.
+ */
+static void load_snapshot(Directory *dir)
+{
+	GPtrArray	*items;
+	guint		i;
+
+	items = dirsnap_load(dir->pathname);
+	if (!items)
+		return;
+
+	time(&diritem_recent_time);
+
+	for (i = 0; i < items->len; i++)
+	{
+		DirItem *item = (DirItem *) items->pdata[i];
+
+		g_hash_table_insert(dir->known_items, item->leafname, item);
+	}
+
+	g_ptr_array_free(items, TRUE);
+}
+
+/* Pass leafname to the worker threads to be restatted.
+ * Takes ownership of leafname.
+ */
+static void queue_restat(Directory *dir, gchar *leafname)
+{
+	RestatJob *job;
+
+	if (restat_mount_async(make_path(dir->pathname, leafname)))
+	{
+		queue_mount_restat(dir, leafname);
+		return;
+	}
+
+	job = g_new0(RestatJob, 1);
+	job->dir = g_object_ref(dir);
+	job->generation = dir->scan_generation;
+	job->leafname = leafname;
+	job->path = g_strdup(make_path(dir->pathname, leafname));
+	job->parent = dir->stat_info;
+	job->scan_fd = dir->scan_fd;
+	if (job->scan_fd)
+		job->scan_fd->ref++;
+
+	dir->restat_pending++;
+	g_thread_pool_push(restat_pool, job, NULL);
+}
+
+/* Called in a worker thread. Only does the system calls; the results are
+ * applied to the DirItem later by restat_jobs_done().
+ */
+static void restat_worker(gpointer data, gpointer user_data)
+{
+	RestatJob *job = (RestatJob *) data;
+
+	if (job->mount)
+	{
+		/* Always finish these, to find out how slow the mount is */
+		diritem_stat_collect(job->path, -1, job->leafname,
+				     &job->parent, &job->st);
+		mount_stat_end(job->path, job->started);
+	}
+	/* Don't bother if the directory has been rescanned since */
+	else if (job->generation ==
+		 g_atomic_int_get(&job->dir->scan_generation))
+		diritem_stat_collect(job->path,
+				     job->scan_fd ? job->scan_fd->fd : -1,
+				     job->leafname, &job->parent, &job->st);
+
+	G_LOCK(restat_done);
+	restat_done = g_list_prepend(restat_done, job);
+	if (!restat_done_idle)
+		restat_done_idle = g_idle_add(restat_jobs_done, NULL);
+	G_UNLOCK(restat_done);
+}
+
+/* Idle callback in the main thread. Apply the results of any finished
+ * restat jobs to their directories.
+ */
+static gboolean restat_jobs_done(gpointer data)
+{
+	GList	*jobs, *next;
+
+	G_LOCK(restat_done);
+	jobs = g_list_reverse(restat_done);
+	restat_done = NULL;
+	restat_done_idle = 0;
+	G_UNLOCK(restat_done);
+
+	time(&diritem_recent_time);
+
+	for (next = jobs; next; next = next->next)
+	{
+		RestatJob *job = (RestatJob *) next->data;
+		Directory *dir = job->dir;
+
+		if (job->mount)
+		{
+			/* (may have been rescanned while we waited, so just
+			 * check that the item is still there)
+			 */
+			if (g_hash_table_lookup(dir->known_items,
+						job->leafname))
+				insert_item(dir, job->leafname, &job->st);
+			goto free_job;
+		}
+
+		dir->restat_pending--;
+
+		if (job->generation == dir->scan_generation)
+			insert_item(dir, job->leafname, &job->st);
+
+		if (dir->recheck_list)
+		{
+			/* Top up the queue once it's half empty */
+			if (dir->restat_pending <= RESTAT_QUEUE_SIZE / 2)
+				set_idle_callback(dir);
+		}
+		else if (dir->restat_pending == 0 && !dir->idle_callback)
+			scan_finished(dir);
+
+free_job:
+		diritem_stat_clear(&job->st);
+		if (job->scan_fd)
+			scan_fd_unref(job->scan_fd);
+		g_free(job->leafname);
+		g_free(job->path);
+		g_free(job);
+		g_object_unref(dir);
+	}
+
+	g_list_free(jobs);
 
 	return FALSE;
 }
 
+/* TRUE if the item at 'path' should be restatted by queue_mount_restat().
+ * Doesn't make any system calls.
+ */
+static gboolean restat_mount_async(const gchar *path)
+{
+	return mount_pool && o_mount_async.int_value && mount_is_live(path);
+}
+
+/* Restat the mount point 'leafname' in a mount_pool thread, so that a slow
+ * or hung filesystem can't hold up anything else. If it is already being
+ * restatted (perhaps stuck), wait for that instead. The item is shown as a
+ * placeholder if the filesystem is known to be slow, or if the restat
+ * misses its deadline. Frees 'leafname'.
+ */
+static void queue_mount_restat(Directory *dir, gchar *leafname)
+{
+	const gchar	*path;
+	RestatJob	*job;
+	MountDeadline	*deadline;
+	gboolean	slow;
+
+	path = make_path(dir->pathname, leafname);
+	slow = mount_is_slow(path);
+
+	if (slow)
+		show_mount_pending(dir, leafname);
+
+	if (mount_stat_pending(path))
+	{
+		g_free(leafname);
+		return;
+	}
+
+	job = g_new0(RestatJob, 1);
+	job->dir = g_object_ref(dir);
+	job->generation = dir->scan_generation;
+	job->leafname = leafname;
+	job->path = g_strdup(path);
+	job->parent = dir->stat_info;
+	job->mount = TRUE;
+	job->started = mount_stat_begin(job->path);
+
+	if (!slow)
+	{
+		deadline = g_new(MountDeadline, 1);
+		deadline->dir = g_object_ref(dir);
+		deadline->leafname = g_strdup(leafname);
+		g_timeout_add(MOUNT_RESTAT_DEADLINE, mount_deadline, deadline);
+	}
+
+	g_thread_pool_push(mount_pool, job, NULL);
+}
+
+/* Timeout for queue_mount_restat() */
+static gboolean mount_deadline(gpointer data)
+{
+	MountDeadline *deadline = (MountDeadline *) data;
+	Directory *dir = deadline->dir;
+
+	if (mount_stat_pending(make_path(dir->pathname, deadline->leafname)))
+		show_mount_pending(dir, deadline->leafname);
+
+	g_object_unref(dir);
+	g_free(deadline->leafname);
+	g_free(deadline);
+
+	return FALSE;
+}
+
+/* Show the placeholder for 'leafname' until its restat finishes */
+static void show_mount_pending(Directory *dir, const gchar *leafname)
+{
+	DirItem *item;
+
+	item = g_hash_table_lookup(dir->known_items, leafname);
+	if (!item || item->flags & ITEM_FLAG_STAT_PENDING)
+		return;
+
+	diritem_mount_pending(item);
+	g_ptr_array_add(dir->up_items, item);
+	delayed_notify(dir);
+}
+
 /* Add all the new items to the items array.
  * Notify everyone who is watching us.
  */
@@ -618,11 +1102,21 @@ static void notify_deleted(Directory *dir, GPtrArray *deleted)
 	in_callback--;
 }
 
+static void add_item_size(gpointer key, gpointer value, gpointer data)
+{
+	*((gsize *) data) += diritem_size((DirItem *) value);
+}
+
+static void drop_collate(gpointer key, gpointer value, gpointer data)
+{
+	diritem_drop_collate((DirItem *) value);
+}
+
 static void mark_unused(gpointer key, gpointer value, gpointer data)
 {
 	DirItem	*item = (DirItem *) value;
 
-	item->may_delete = TRUE;
+	item->flags |= ITEM_FLAG_MAY_DELETE;
 }
 
 static void keep_deleted(gpointer key, gpointer value, gpointer data)
@@ -630,7 +1124,7 @@ static void keep_deleted(gpointer key, gpointer value, gpointer data)
 	DirItem	*item = (DirItem *) value;
 	GPtrArray *deleted = (GPtrArray *) data;
 
-	if (item->may_delete)
+	if (item->flags & ITEM_FLAG_MAY_DELETE)
 		g_ptr_array_add(deleted, item);
 }
 
@@ -638,7 +1132,7 @@ static gboolean check_unused(gpointer key, gpointer value, gpointer data)
 {
 	DirItem	*item = (DirItem *) value;
 
-	return item->may_delete;
+	return (item->flags & ITEM_FLAG_MAY_DELETE) != 0;
 }
 
 /* Remove all the old items that have gone.
@@ -663,7 +1157,7 @@ static void remove_missing(Directory *dir, GPtrArray *keep)
 		item = g_hash_table_lookup(dir->known_items, leaf);
 
 		if (item)
-			item->may_delete = FALSE;
+			item->flags &= ~ITEM_FLAG_MAY_DELETE;
 	}
 
 	/* Add each item still marked to 'deleted' */
@@ -702,11 +1196,14 @@ static void delayed_notify(Directory *dir)
 }
 
 /* Stat this item and add, update or remove it.
+ * If st is non-NULL, it holds the results of diritem_stat_collect() for
+ * the item, and no system calls are made here.
  * Returns the new/updated item, if any.
  * (leafname may be from the current DirItem item)
  * Ensure diritem_recent_time is reasonably up-to-date before calling this.
  */
-static DirItem *insert_item(Directory *dir, const guchar *leafname)
+static DirItem *insert_item(Directory *dir, const guchar *leafname,
+			     DirItemStat *st)
 {
 	const gchar  	*full_path;
 	DirItem		*item;
@@ -720,6 +1217,22 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 	full_path = make_path(dir->pathname, leafname);
 	item = g_hash_table_lookup(dir->known_items, leafname);
 
+	if (!st && restat_mount_async(full_path))
+	{
+		/* Don't risk hanging here; the results come later */
+		if (!item)
+		{
+			item = diritem_new(leafname);
+			g_ptr_array_add(dir->new_items, item);
+			g_hash_table_insert(dir->known_items,
+					    item->leafname, item);
+			delayed_notify(dir);
+		}
+		item->flags &= ~ITEM_FLAG_NEED_RESCAN_QUEUE;
+		queue_mount_restat(dir, g_strdup(leafname));
+		return item;
+	}
+
 	if (item)
 	{
 		if (item->base_type != TYPE_UNKNOWN)
@@ -730,7 +1243,7 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 				g_object_ref(old._image);
 			do_compare = TRUE;
 		}
-		diritem_restat(full_path, item, &dir->stat_info);
+		restat_item(dir, full_path, item, st);
 	}
 	else
 	{
@@ -739,7 +1252,7 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 		 * we get here.
 		 */
 		item = diritem_new(leafname);
-		diritem_restat(full_path, item, &dir->stat_info);
+		restat_item(dir, full_path, item, st);
 		if (item->base_type == TYPE_ERROR &&
 				item->lstat_errno == ENOENT)
 		{
@@ -748,6 +1261,10 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 		}
 		g_ptr_array_add(dir->new_items, item);
 
+		/* Make it known now, so that further changes before the
+		 * next merge find this item rather than adding another.
+		 */
+		g_hash_table_insert(dir->known_items, item->leafname, item);
 	}
 
 	/* No need to queue the item for scanning. If we got here because
@@ -759,9 +1276,17 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 	{
 		/* Item has been deleted */
 		g_hash_table_remove(dir->known_items, item->leafname);
-		g_ptr_array_add(dir->gone_items, item);
 		if (do_compare && old._image)
 			g_object_unref(old._image);
+		if (g_ptr_array_remove_fast(dir->new_items, item))
+		{
+			/* Gone before anyone heard about it */
+			while (g_ptr_array_remove_fast(dir->up_items, item))
+				;
+			diritem_free(item);
+			return NULL;
+		}
+		g_ptr_array_add(dir->gone_items, item);
 		delayed_notify(dir);
 		return NULL;
 	}
@@ -798,10 +1323,39 @@ static DirItem *insert_item(Directory *dir, const guchar *leafname)
 	return item;
 }
 
-static void update(Directory *dir, gchar *pathname, gpointer data)
+/* See insert_item() */
+static void restat_item(Directory *dir, const gchar *full_path,
+			DirItem *item, DirItemStat *st)
+{
+	if (st)
+		diritem_restat_apply(full_path, item, st);
+	else
+		diritem_restat_at(full_path,
+				  dir->scan_fd ? dir->scan_fd->fd : -1,
+				  item, &dir->stat_info);
+}
+
+/* Replace dir->pathname with 'pathname' (which is taken over) */
+static void set_pathname(Directory *dir, gchar *pathname)
 {
+#ifdef USE_INOTIFY
+	/* watched_dirs is keyed on the path */
+	if (dir->notify_fd != -1)
+		g_hash_table_remove(watched_dirs, dir->pathname);
+#endif
 	g_free(dir->pathname);
-	dir->pathname = pathdup(pathname);
+	dir->pathname = pathname;
+#ifdef USE_INOTIFY
+	if (dir->notify_fd != -1)
+		g_hash_table_insert(watched_dirs, g_strdup(pathname), dir);
+#endif
+}
+
+static void update(Directory *dir, gchar *pathname, gpointer data)
+{
+	set_pathname(dir, pathdup(pathname));
+	close_scan_fd(dir);	/* Reopened for the new path if needed */
+	g_atomic_int_inc(&dir->scan_generation);
 
 	if (dir->scanning)
 		dir->needs_update = TRUE;
@@ -814,12 +1368,12 @@ static void update(Directory *dir, gchar *pathname, gpointer data)
  */
 static void set_idle_callback(Directory *dir)
 {
-	if (dir->recheck_list && dir->users)
+	if ((dir->recheck_list || dir->restat_pending) && dir->users)
 	{
 		/* Work to do, and someone's watching */
 		dir_set_scanning(dir, TRUE);
-		if (dir->idle_callback)
-			return;
+		if (dir->idle_callback || !dir->recheck_list)
+			return;	/* Already running, or waiting for workers */
 		time(&diritem_recent_time);
 		dir->idle_callback = g_idle_add(recheck_callback, dir);
 		/* Do the first call now (will remove the callback itself) */
@@ -833,9 +1387,51 @@ static void set_idle_callback(Directory *dir)
 			g_source_remove(dir->idle_callback);
 			dir->idle_callback = 0;
 		}
+		close_scan_fd(dir);
 	}
 }
 
+/* Open dir->scan_fd, so that queued items can be restatted relative to
+ * the directory. If this fails, items are restatted by path instead.
+ */
+static void open_scan_fd(Directory *dir)
+{
+#ifdef USE_FSTATAT
+	int	fd;
+
+	if (dir->scan_fd)
+		return;
+
+	fd = open(dir->pathname, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return;
+	close_on_exec(fd, TRUE);
+
+	dir->scan_fd = g_new(ScanFD, 1);
+	dir->scan_fd->fd = fd;
+	dir->scan_fd->ref = 1;
+#endif
+}
+
+/* Drop the directory's reference. Restat jobs may still be using it. */
+static void close_scan_fd(Directory *dir)
+{
+	if (!dir->scan_fd)
+		return;
+
+	scan_fd_unref(dir->scan_fd);
+	dir->scan_fd = NULL;
+}
+
+static void scan_fd_unref(ScanFD *scan_fd)
+{
+	if (--scan_fd->ref)
+		return;
+
+	close(scan_fd->fd);
+	g_free(scan_fd);
+}
+
 /* See dir_force_update_path() */
 static void dir_force_update_item(Directory *dir, const gchar *leaf)
 {
@@ -869,13 +1465,11 @@ out:
 static void dir_recheck(Directory *dir,
 			const guchar *path, const guchar *leafname)
 {
-	guchar *old = dir->pathname;
-
-	dir->pathname = g_strdup(path);
-	g_free(old);
+	set_pathname(dir, g_strdup(path));
+	close_scan_fd(dir);
 
 	time(&diritem_recent_time);
-	insert_item(dir, leafname);
+	insert_item(dir, leafname, NULL);
 }
 
 static void to_array(gpointer key, gpointer value, gpointer data)
@@ -915,6 +1509,10 @@ static void dir_finialize(GObject *object)
 	set_idle_callback(dir);
 	if (dir->rescan_timeout != -1)
 		g_source_remove(dir->rescan_timeout);
+#ifdef USE_INOTIFY
+	cancel_changed(dir);
+	g_hash_table_destroy(dir->changed_items);
+#endif
 
 	dir_merge_new(dir);	/* Ensures new, up and gone are empty */
 
@@ -957,11 +1555,19 @@ static void directory_init(GTypeInstance *object, gpointer gclass)
 	dir->pathname = NULL;
 	dir->error = NULL;
 	dir->rescan_timeout = -1;
+	dir->scan_fd = NULL;
+	dir->scan_generation = 0;
+	dir->restat_pending = 0;
 #ifdef USE_NOTIFY
 	dir->notify_fd = -1;
 #endif
 #ifdef USE_INOTIFY
 	dir->inotify_source = 0;
+	dir->polled = FALSE;
+	dir->last_viewed = 0;
+	dir->changed_items = g_hash_table_new_full(g_str_hash, g_str_equal,
+						   g_free, NULL);
+	dir->changed_timeout = 0;
 #endif
 
 	dir->new_items = g_ptr_array_new();
@@ -1025,6 +1631,9 @@ static void dir_rescan(Directory *dir)
 
 	dir->needs_update = FALSE;
 
+	/* Results for items queued before now are out-of-date */
+	g_atomic_int_inc(&dir->scan_generation);
+
 	names = g_ptr_array_new();
 
 	read_globicons();
@@ -1147,7 +1756,7 @@ static gboolean inotify_handler(GIOChannel *source, GIOCondition condition,
 				gpointer udata)
 {
 	int fd = g_io_channel_unix_get_fd(source);
-	Directory *dir;
+	Watch *watch;
 	char buf[sizeof(struct inotify_event)+1024];
 	int len, i = 0;
 
@@ -1165,10 +1774,28 @@ static gboolean inotify_handler(GIOChannel *source, GIOCondition condition,
 	{
 		struct inotify_event *event=(struct inotify_event *) (buf+i);
 
-		dir = g_hash_table_lookup(notify_fd_to_dir,
-					  GINT_TO_POINTER(event->wd));
-		if (dir)
-			dir_rescan_soon(dir);
+		watch = g_hash_table_lookup(watches,
+					    GINT_TO_POINTER(event->wd));
+		if (watch)
+		{
+			GList *next;
+
+			for (next = watch->dirs; next; next = next->next)
+				inotify_file_event(next->data, event);
+
+			/* The directory itself has gone; no more events */
+			if (event->mask & IN_IGNORED)
+			{
+				forget_watch(watch, FALSE);
+				promote_polled();
+			}
+		}
+		else if (event->mask & IN_Q_OVERFLOW)
+		{
+			/* Missed something; we can't tell what */
+			g_fscache_distrust_all();
+			g_hash_table_foreach(watches, rescan_watched, NULL);
+		}
     
 		i += sizeof(*event)+event->len;
 	}
@@ -1176,4 +1803,361 @@ static gboolean inotify_handler(GIOChannel *source, GIOCondition condition,
 
 	return TRUE;
 }
+
+/* Tell any GFSCaches about the change, and update the item it names.
+ * Only events that don't say which item changed need a full rescan.
+ */
+static void inotify_file_event(Directory *dir, struct inotify_event *event)
+{
+	if (event->mask & IN_IGNORED)
+		g_fscache_distrust_all();	/* See forget_watch() */
+	else if (event->mask & (IN_DELETE | IN_MOVE) ||
+		 (event->mask & IN_ISDIR && event->mask & IN_ATTRIB))
+	{
+		/* Paths inside a directory (or symlink to one) may
+		 * now be different files, or unreadable.
+		 */
+		g_fscache_distrust_all();
+	}
+	else if (event->len)
+		g_fscache_path_changed(make_path(dir->pathname, event->name));
+
+	/* Writes don't change the listing, but do change sizes and times */
+	if (!(event->mask & ~(IN_MODIFY | IN_CLOSE_WRITE)))
+	{
+		if (event->len)
+			item_written(dir, event->name);
+		return;
+	}
+
+	if (event->len && !(event->mask & IN_IGNORED) &&
+	    event->mask & (IN_CREATE | IN_DELETE | IN_MOVE | IN_ATTRIB))
+	{
+		/* Restat just this item. A rename arrives as a MOVED_FROM
+		 * (which finds the old name gone) and a MOVED_TO (which
+		 * finds the new one), in this directory or another.
+		 */
+		time(&diritem_recent_time);
+		insert_item(dir, event->name, NULL);
+	}
+	else
+		dir_rescan_soon(dir);
+}
+
+static void rescan_watched(gpointer key, gpointer value, gpointer data)
+{
+	g_list_foreach(((Watch *) value)->dirs, (GFunc) dir_rescan_soon, NULL);
+}
+
+/* 'leafname' has been written to. Rather than restatting it for every
+ * write, remember it and restat everything written to when the timeout
+ * fires. Later writes before then are absorbed.
+ */
+static void item_written(Directory *dir, const gchar *leafname)
+{
+	if (!g_hash_table_lookup(dir->known_items, leafname))
+		return;		/* Not listed yet; the create will add it */
+
+	if (g_hash_table_lookup_extended(dir->changed_items, leafname,
+					 NULL, NULL))
+		return;
+
+	g_hash_table_insert(dir->changed_items, g_strdup(leafname), NULL);
+
+	if (!dir->changed_timeout)
+		dir->changed_timeout = g_timeout_add(CHANGED_RESTAT_INTERVAL,
+						     restat_changed, dir);
+}
+
+static void restat_one(gpointer key, gpointer value, gpointer data)
+{
+	insert_item((Directory *) data, (guchar *) key, NULL);
+}
+
+/* Timeout for item_written() */
+static gboolean restat_changed(gpointer data)
+{
+	Directory *dir = (Directory *) data;
+
+	dir->changed_timeout = 0;
+
+	time(&diritem_recent_time);
+	g_hash_table_foreach(dir->changed_items, restat_one, dir);
+	g_hash_table_remove_all(dir->changed_items);
+
+	return FALSE;
+}
+
+/* Forget any pending item_written() restats */
+static void cancel_changed(Directory *dir)
+{
+	if (dir->changed_timeout)
+	{
+		g_source_remove(dir->changed_timeout);
+		dir->changed_timeout = 0;
+	}
+	g_hash_table_remove_all(dir->changed_items);
+}
+
+/* Start watching 'dir', which has just got its first user. Polls it
+ * instead if we are out of watches.
+ */
+static void watch_dir(Directory *dir)
+{
+	if (!add_watch(dir))
+		start_polling(dir);
+}
+
+/* 'dir' has lost its last user; stop watching or polling it */
+static void unwatch_dir(Directory *dir)
+{
+	Watch	*watch;
+
+	if (dir->polled)
+	{
+		polled_dirs = g_list_remove(polled_dirs, dir);
+		dir->polled = FALSE;
+		return;
+	}
+
+	if (dir->notify_fd == -1)
+		return;
+
+	watch = g_hash_table_lookup(watches, GINT_TO_POINTER(dir->notify_fd));
+	g_return_if_fail(watch != NULL);
+
+	g_hash_table_remove(watched_dirs, dir->pathname);
+	dir->notify_fd = -1;
+	watch->dirs = g_list_remove(watch->dirs, dir);
+
+	if (watch->dirs)
+		g_fscache_distrust_all();
+	else
+	{
+		forget_watch(watch, TRUE);
+		promote_polled();	/* Give the watch to someone else */
+	}
+}
+
+/* Add an inotify watch for 'dir', sharing one if its inode is already
+ * watched. If that would go over budget, the least recently viewed
+ * watch is given up first. Returns FALSE if no watch could be added.
+ */
+static gboolean add_watch(Directory *dir)
+{
+	Watch	*watch;
+	int	wd;
+
+	/* (IN_MODIFY and IN_CLOSE_WRITE keep GFSCaches and the
+	 * sizes of growing files up-to-date; see item_written())
+	 */
+	wd = inotify_add_watch(inotify_fd, dir->pathname,
+			       IN_CREATE | IN_DELETE | IN_MOVE |
+			       IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE);
+
+	if (wd == -1 && errno == ENOSPC)
+	{
+		/* Other programs have the rest; don't try for more */
+		watch_budget = g_hash_table_size(watches);
+		if (evict_watch())
+			wd = inotify_add_watch(inotify_fd, dir->pathname,
+					IN_CREATE | IN_DELETE | IN_MOVE |
+					IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE);
+	}
+	if (wd == -1)
+		return FALSE;
+
+	watch = g_hash_table_lookup(watches, GINT_TO_POINTER(wd));
+	if (!watch)
+	{
+		if (g_hash_table_size(watches) >= watch_budget &&
+		    !evict_watch())
+		{
+			inotify_rm_watch(inotify_fd, wd);
+			return FALSE;
+		}
+
+		watch = g_new(Watch, 1);
+		watch->wd = wd;
+		watch->dirs = NULL;
+		g_hash_table_insert(watches, GINT_TO_POINTER(wd), watch);
+	}
+
+	watch->dirs = g_list_prepend(watch->dirs, dir);
+	dir->notify_fd = wd;
+	g_hash_table_insert(watched_dirs, g_strdup(dir->pathname), dir);
+
+	return TRUE;
+}
+
+/* Stop using 'watch' and free it. Its Directories are left with neither
+ * a watch nor polling. If 'remove' is set, tell the kernel too (not
+ * needed if it has already dropped the watch).
+ */
+static void forget_watch(Watch *watch, gboolean remove)
+{
+	GList	*next;
+
+	for (next = watch->dirs; next; next = next->next)
+	{
+		Directory *dir = (Directory *) next->data;
+
+		g_hash_table_remove(watched_dirs, dir->pathname);
+		dir->notify_fd = -1;
+	}
+
+	if (remove)
+		inotify_rm_watch(inotify_fd, watch->wd);
+
+	g_hash_table_remove(watches, GINT_TO_POINTER(watch->wd));
+	g_list_free(watch->dirs);
+	g_free(watch);
+
+	g_fscache_distrust_all();
+}
+
+/* When the watch was last useful: the latest view of any of its dirs */
+static time_t watch_viewed(Watch *watch)
+{
+	GList	*next;
+	time_t	viewed = 0;
+
+	for (next = watch->dirs; next; next = next->next)
+	{
+		Directory *dir = (Directory *) next->data;
+
+		viewed = MAX(viewed, dir->last_viewed);
+	}
+
+	return viewed;
+}
+
+static void find_oldest_watch(gpointer key, gpointer value, gpointer data)
+{
+	Watch	**oldest = (Watch **) data;
+	Watch	*watch = (Watch *) value;
+
+	if (!*oldest || watch_viewed(watch) < watch_viewed(*oldest))
+		*oldest = watch;
+}
+
+/* Switch the directories of the least recently viewed watch over to
+ * polling, freeing a watch. FALSE if we have none to free.
+ */
+static gboolean evict_watch(void)
+{
+	Watch	*oldest = NULL;
+	GList	*dirs, *next;
+
+	g_hash_table_foreach(watches, find_oldest_watch, &oldest);
+	if (!oldest)
+		return FALSE;
+
+	dirs = g_list_copy(oldest->dirs);
+	forget_watch(oldest, TRUE);
+
+	for (next = dirs; next; next = next->next)
+		start_polling((Directory *) next->data);
+	g_list_free(dirs);
+
+	return TRUE;
+}
+
+/* Watches have been freed. Give them to the most recently viewed
+ * polled directories.
+ */
+static void promote_polled(void)
+{
+	while (polled_dirs && g_hash_table_size(watches) < watch_budget)
+	{
+		Directory *dir;
+
+		polled_dirs = g_list_sort_with_data(polled_dirs,
+						    cmp_viewed, NULL);
+		dir = (Directory *) polled_dirs->data;
+		polled_dirs = g_list_remove(polled_dirs, dir);
+		dir->polled = FALSE;
+
+		if (!add_watch(dir))
+		{
+			start_polling(dir);
+			break;
+		}
+
+		poll_dir(dir);	/* Catch anything since the last poll */
+	}
+}
+
+static void start_polling(Directory *dir)
+{
+	dir->polled = TRUE;
+	polled_dirs = g_list_prepend(polled_dirs, dir);
+
+	if (!poll_timeout)
+		poll_timeout = g_timeout_add(POLL_INTERVAL, poll_dirs, NULL);
+}
+
+/* Timeout for polled_dirs */
+static gboolean poll_dirs(gpointer data)
+{
+	g_list_foreach(polled_dirs, (GFunc) poll_dir, NULL);
+
+	if (polled_dirs)
+		return TRUE;
+
+	poll_timeout = 0;
+	return FALSE;
+}
+
+/* Rescan 'dir' if it has changed since it was last scanned. This only
+ * notices changes to the listing, not to the files in it.
+ */
+static void poll_dir(Directory *dir)
+{
+	struct stat info;
+
+	if (mc_stat(dir->pathname, &info) == 0 &&
+	    info.st_ino == dir->stat_info.st_ino &&
+	    info.st_dev == dir->stat_info.st_dev &&
+	    info.st_mtime == dir->stat_info.st_mtime &&
+	    info.st_ctime == dir->stat_info.st_ctime)
+		return;
+
+	dir_rescan_soon(dir);
+}
+
+/* Most recently viewed first */
+static gint cmp_viewed(gconstpointer a, gconstpointer b, gpointer data)
+{
+	time_t	va = ((Directory *) a)->last_viewed;
+	time_t	vb = ((Directory *) b)->last_viewed;
+
+	return va > vb ? -1 : va < vb ? 1 : 0;
+}
+
+/* We use a share of the user's inotify watches; see WATCH_BUDGET_DIVISOR */
+static guint read_watch_budget(void)
+{
+	gchar	*contents;
+	gulong	max_watches = 0;
+
+	if (g_file_get_contents("/proc/sys/fs/inotify/max_user_watches",
+				&contents, NULL, NULL))
+	{
+		max_watches = strtoul(contents, NULL, 10);
+		g_free(contents);
+	}
+	if (!max_watches)
+		max_watches = DEFAULT_MAX_WATCHES;
+
+	return MAX(max_watches / WATCH_BUDGET_DIVISOR, 1);
+}
+
+/* Used by GFSCache to see whether it can trust files in 'path' without
+ * checking them.
+ */
+static gboolean dir_path_watched(const char *path)
+{
+	return g_hash_table_lookup(watched_dirs, path) != NULL;
+}
 #endif
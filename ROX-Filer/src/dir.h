@@ -35,6 +35,7 @@ typedef enum {
 } DirAction;
 
 typedef struct _DirUser DirUser;
+typedef struct _ScanFD ScanFD;
 typedef void (*DirCallback)(Directory *dir,
 			DirAction action,
 			GPtrArray *items,
@@ -89,11 +90,27 @@ struct _Directory
 
 	gint		rescan_timeout;	/* See dir_rescan_soon() */
 
+	/* Open on pathname while the recheck_list is being processed,
+	 * so that items can be restatted relative to it. NULL otherwise.
+	 */
+	ScanFD		*scan_fd;
+
+	gint		scan_generation; /* Incremented on each rescan */
+	gint		restat_pending;	/* Items with the worker threads */
+
 #ifdef USE_NOTIFY
 	int		notify_fd;	/* -1 if not watching */
 #endif
 #ifdef USE_INOTIFY
         guint           inotify_source;
+
+	/* Without a watch (see dir.c), changes are found by polling */
+	gboolean	polled;
+	time_t		last_viewed;	/* Time of the last dir_attach() */
+
+	/* Leafnames of items written to since changed_timeout was set */
+	GHashTable	*changed_items;
+	guint		changed_timeout;
 #endif
 };
 
@@ -106,6 +123,9 @@ void dir_check_this(const guchar *path);
 DirItem *dir_update_item(Directory *dir, const gchar *leafname);
 void dir_merge_new(Directory *dir);
 void dir_force_update_path(const gchar *path);
+gboolean dir_memory_usage(const gchar *path, guint *n_items, gsize *bytes);
+GList *dir_watch_usage(guint *used, guint *budget);
+gboolean dir_is_polled(const gchar *path);
 #if defined(USE_DNOTIFY)
 void dnotify_wakeup(void);
 #endif
@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
 
 #include "global.h"
 
@@ -45,6 +46,10 @@
 #include "pixmaps.h"
 #include "xtypes.h"
 
+/* Bits for DirItemStat.icons */
+#define DIR_STAT_DIRICON 0x1	/* .DirIcon is usable */
+#define DIR_STAT_APPICON 0x2	/* AppIcon.xpm is usable */
+
 #define RECENT_DELAY (5 * 60)	/* Time in seconds to consider a file recent */
 #define ABOUT_NOW(time) (diritem_recent_time - time < RECENT_DELAY)
 /* If you want to make use of the RECENT flag, make sure this is set to
@@ -53,8 +58,12 @@
 time_t diritem_recent_time;
 
 /* Static prototypes */
-static void examine_dir(const guchar *path, DirItem *item,
-			struct stat *link_target);
+static void collect_dir(const guchar *path, DirItemStat *st);
+static void examine_dir(const guchar *path, DirItem *item, DirItemStat *st);
+static int item_lstat(const guchar *path, int dir_fd,
+		      const guchar *leafname, struct stat *info);
+static int item_stat(const guchar *path, int dir_fd,
+		     const guchar *leafname, struct stat *info);
 
 /****************************************************************
  *			EXTERNAL INTERFACE			*
@@ -70,8 +79,94 @@ void diritem_init(void)
  */
 void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
 {
-	struct stat	info;
+	diritem_restat_at(path, -1, item, parent);
+}
+
+/* As diritem_restat(), but if dir_fd is not -1 then it is an open
+ * descriptor for the directory containing the item, and the item is
+ * lstat()ed and stat()ed relative to it using only item->leafname. This
+ * saves the kernel looking up every component of 'path' again for each
+ * item, which is slow on network filesystems.
+ * 'path' is still needed for the checks which have no *at() form
+ * (extended attributes, MIME sniffing, mount points, etc).
+ */
+void diritem_restat_at(const guchar *path, int dir_fd,
+		       DirItem *item, struct stat *parent)
+{
+	DirItemStat	st;
 
+	diritem_stat_collect(path, dir_fd, item->leafname, parent, &st);
+	diritem_restat_apply(path, item, &st);
+	diritem_stat_clear(&st);
+}
+
+/* Do all the slow parts of restatting the item 'leafname' at 'path' (see
+ * diritem_restat_at() for 'dir_fd' and 'parent'), storing the results in 'st'
+ * for diritem_restat_apply(). This only makes system calls and doesn't touch
+ * any of the filer's data structures, so it may be called from any thread.
+ * Use diritem_stat_clear() to free the results.
+ */
+void diritem_stat_collect(const guchar *path, int dir_fd,
+			  const guchar *leafname, struct stat *parent,
+			  DirItemStat *st)
+{
+	const guchar	*target_path;
+	int		base_type;
+
+	memset(st, 0, sizeof(*st));
+
+	if (item_lstat(path, dir_fd, leafname, &st->lstat_info) == -1)
+	{
+		st->lstat_errno = errno;
+		return;
+	}
+
+	st->info = st->lstat_info;
+
+	if (xattr_have(path))
+		st->flags |= ITEM_FLAG_HAS_XATTR;
+
+	if (S_ISLNK(st->lstat_info.st_mode))
+	{
+		st->flags |= ITEM_FLAG_SYMLINK;
+
+		if (item_stat(path, dir_fd, leafname, &st->info))
+		{
+			st->stat_errno = errno ? errno : ENOENT;
+			return;
+		}
+
+		st->target_path = pathdup(path);
+	}
+
+	target_path = st->target_path ? st->target_path : (gchar *) path;
+	base_type = mode_to_base_type(st->info.st_mode);
+
+	if (base_type == TYPE_DIRECTORY)
+	{
+		if (mount_is_mounted(target_path, &st->info,
+				st->target_path ? NULL : parent))
+			st->flags |= ITEM_FLAG_MOUNT_POINT | ITEM_FLAG_MOUNTED;
+		else if (mount_is_in_fstab(target_path))
+			st->flags |= ITEM_FLAG_MOUNT_POINT;
+
+		/* KRJW: st->info.st_uid will be the uid of the dir,
+		 * regardless of whether `path' is a dir or a symlink to one.
+		 * Note that if path is a symlink to a dir, item->uid will be
+		 * the uid of the *symlink*, but we really want the uid of the
+		 * dir to which the symlink points.
+		 */
+		collect_dir(path, st);
+	}
+	else if (base_type == TYPE_FILE)
+		st->mime_name = type_name_from_path(target_path);
+}
+
+/* Bring this item's structure uptodate using the results of
+ * diritem_stat_collect(). Main thread only.
+ */
+void diritem_restat_apply(const guchar *path, DirItem *item, DirItemStat *st)
+{
 	if (item->_image)
 	{
 		g_object_unref(item->_image);
@@ -80,9 +175,9 @@ void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
 	item->flags = 0;
 	item->mime_type = NULL;
 
-	if (mc_lstat(path, &info) == -1)
+	if (st->lstat_errno)
 	{
-		item->lstat_errno = errno;
+		item->lstat_errno = st->lstat_errno;
 		item->base_type = TYPE_ERROR;
 		item->size = 0;
 		item->mode = 0;
@@ -92,81 +187,36 @@ void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
 	}
 	else
 	{
-		guchar *target_path;
+		struct stat *info = &st->lstat_info;
 
 		item->lstat_errno = 0;
-		item->size = info.st_size;
-		item->mode = info.st_mode;
-		item->atime = info.st_atime;
-		item->ctime = info.st_ctime;
-		item->mtime = info.st_mtime;
-		item->uid = info.st_uid;
-		item->gid = info.st_gid;
+		item->size = info->st_size;
+		item->mode = info->st_mode;
+		item->atime = info->st_atime;
+		item->ctime = info->st_ctime;
+		item->mtime = info->st_mtime;
+		item->uid = info->st_uid;
+		item->gid = info->st_gid;
 		if (ABOUT_NOW(item->mtime) || ABOUT_NOW(item->ctime))
 			item->flags |= ITEM_FLAG_RECENT;
 
-		if (xattr_have(path))
-			item->flags |= ITEM_FLAG_HAS_XATTR;
-
-		if (S_ISLNK(info.st_mode))
-		{
-			if (mc_stat(path, &info))
-				item->base_type = TYPE_ERROR;
-			else
-				item->base_type =
-					mode_to_base_type(info.st_mode);
+		item->flags |= st->flags;
 
-			item->flags |= ITEM_FLAG_SYMLINK;
-
-			target_path = pathdup(path);
-		}
+		if (st->stat_errno)
+			item->base_type = TYPE_ERROR;
 		else
-		{
-			item->base_type = mode_to_base_type(info.st_mode);
-			target_path = (guchar *) path;
-		}
-
-		if (item->base_type == TYPE_DIRECTORY)
-		{
-			if (mount_is_mounted(target_path, &info,
-					target_path == path ? parent : NULL))
-				item->flags |= ITEM_FLAG_MOUNT_POINT
-						| ITEM_FLAG_MOUNTED;
-			else if (g_hash_table_lookup(fstab_mounts,
-							target_path))
-				item->flags |= ITEM_FLAG_MOUNT_POINT;
-		}
-
-		if (path != target_path)
-			g_free(target_path);
+			item->base_type = mode_to_base_type(st->info.st_mode);
 	}
 
 	if (item->base_type == TYPE_DIRECTORY)
-	{
-		/* KRJW: info.st_uid will be the uid of the dir, regardless
-		 * of whether `path' is a dir or a symlink to one.  Note that
-		 * if path is a symlink to a dir, item->uid will be the uid
-		 * of the *symlink*, but we really want the uid of the dir
-		 * to which the symlink points.
-		 */
-		examine_dir(path, item, &info);
-	}
+		examine_dir(path, item, st);
 	else if (item->base_type == TYPE_FILE)
 	{
-		if (item->flags & ITEM_FLAG_SYMLINK)
-		{
-			guchar *link_path;
-			link_path = pathdup(path);
-			item->mime_type = type_from_path(link_path
-					? link_path
-					: path);
-			g_free(link_path);
-		}
-		else
-			item->mime_type = type_from_path(path);
+		if (st->mime_name)
+			item->mime_type = mime_type_lookup(st->mime_name);
 	
 		/* Note: for symlinks we need the mode of the target */
-		if (info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))
+		if (st->info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))
 		{
 			/* Note that the flag is set for ALL executable
 			 * files, but the mime_type must also be executable
@@ -207,18 +257,30 @@ void diritem_restat(const guchar *path, DirItem *item, struct stat *parent)
 		item->mime_type = mime_type_from_base_type(item->base_type);
 }
 
+/* Free the results of diritem_stat_collect() */
+void diritem_stat_clear(DirItemStat *st)
+{
+	null_g_free(&st->target_path);
+	null_g_free(&st->mime_name);
+}
+
+/* The item and its leafname are allocated together, so that large
+ * directories need only one allocation per item.
+ */
 DirItem *diritem_new(const guchar *leafname)
 {
 	DirItem		*item;
+	gsize		len = strlen(leafname) + 1;
 
-	item = g_new(DirItem, 1);
-	item->leafname = g_strdup(leafname);
-	item->may_delete = FALSE;
+	item = g_malloc(sizeof(DirItem) + len);
+	item->leafname = (guchar *) (item + 1);
+	memcpy(item->leafname, leafname, len);
+
+	item->_collate = NULL;
 	item->_image = NULL;
 	item->base_type = TYPE_UNKNOWN;
 	item->flags = ITEM_FLAG_NEED_RESCAN_QUEUE;
 	item->mime_type = NULL;
-	item->leafname_collate = collate_key_new(leafname);
 
 	return item;
 }
@@ -230,11 +292,70 @@ void diritem_free(DirItem *item)
 	if (item->_image)
 		g_object_unref(item->_image);
 	item->_image = NULL;
-	collate_key_free(item->leafname_collate);
-	g_free(item->leafname);
+	diritem_drop_collate(item);
 	g_free(item);
 }
 
+/* The mount point 'item' is taking too long to restat (see dir.c). Show it
+ * as a placeholder until the results arrive, keeping any details we
+ * already had.
+ */
+void diritem_mount_pending(DirItem *item)
+{
+	if (item->base_type == TYPE_UNKNOWN)
+	{
+		item->lstat_errno = 0;
+		item->base_type = TYPE_DIRECTORY;
+		item->size = 0;
+		item->mode = S_IFDIR;
+		item->mtime = item->ctime = item->atime = 0;
+		item->uid = (uid_t) -1;
+		item->gid = (gid_t) -1;
+	}
+
+	item->flags |= ITEM_FLAG_MOUNT_POINT | ITEM_FLAG_MOUNTED |
+			ITEM_FLAG_STAT_PENDING;
+	item->mime_type = inode_mountpoint;
+
+	if (item->_image)
+		g_object_unref(item->_image);
+	item->_image = im_mount_pending;
+	g_object_ref(item->_image);
+}
+
+/* The number of bytes of memory used by this item, not counting its image
+ * (which is shared).
+ */
+gsize diritem_size(DirItem *item)
+{
+	gsize	size = sizeof(DirItem) + strlen(item->leafname) + 1;
+
+	if (item->_collate)
+		size += collate_key_size(item->_collate);
+
+	return size;
+}
+
+/* For use by di_collate() only. Sets item->_collate. */
+void _diritem_get_collate(DirItem *item)
+{
+	g_return_if_fail(item->_collate == NULL);
+
+	item->_collate = collate_key_new(item->leafname);
+}
+
+/* Free the item's collate key. di_collate() will make a new one if needed.
+ * Used to save memory when no-one is looking at the item.
+ */
+void diritem_drop_collate(DirItem *item)
+{
+	if (item->_collate)
+	{
+		collate_key_free(item->_collate);
+		item->_collate = NULL;
+	}
+}
+
 /* For use by di_image() only. Sets item->_image. */
 void _diritem_get_image(DirItem *item)
 {
@@ -253,51 +374,58 @@ void _diritem_get_image(DirItem *item)
  *			INTERNAL FUNCTIONS			*
  ****************************************************************/
 
-/* Fill in more details of the DirItem for a directory item.
- * - Looks for an image (but maybe still NULL on error)
- * - Updates ITEM_FLAG_APPDIR
+/* lstat() the item, relative to dir_fd if possible */
+static int item_lstat(const guchar *path, int dir_fd,
+		      const guchar *leafname, struct stat *info)
+{
+#ifdef USE_FSTATAT
+	if (dir_fd != -1)
+		return fstatat(dir_fd, leafname, info,
+			       AT_SYMLINK_NOFOLLOW);
+#endif
+	return mc_lstat(path, info);
+}
+
+/* stat() the item, relative to dir_fd if possible */
+static int item_stat(const guchar *path, int dir_fd,
+		     const guchar *leafname, struct stat *info)
+{
+#ifdef USE_FSTATAT
+	if (dir_fd != -1)
+		return fstatat(dir_fd, leafname, info, 0);
+#endif
+	return mc_stat(path, info);
+}
+
+/* The directory-specific part of diritem_stat_collect().
+ * Checks which of the files giving the directory's icon are usable:
+ *
+ * - If it contains a .DirIcon then that's the icon
+ * - If it contains an AppRun then it's an application
+ * - If it contains an AppRun but no .DirIcon then try to
+ *   use AppIcon.xpm as the icon.
  *
- * link_target contains stat info for the link target for symlinks (or for the
- * item itself if not a link).
+ * .DirIcon and AppRun must have the same owner as the
+ * directory itself, to prevent abuse of /tmp, etc.
+ * For symlinks, we want the symlink's owner.
+ *
+ * Sets ITEM_FLAG_APPDIR and DIR_STAT_* in st.
  */
-static void examine_dir(const guchar *path, DirItem *item,
-			struct stat *link_target)
+static void collect_dir(const guchar *path, DirItemStat *st)
 {
 	struct stat info;
-	static GString *tmp = NULL;
-	uid_t uid = link_target->st_uid;
-
-	if (!tmp)
-		tmp = g_string_new(NULL);
+	GString *tmp;
+	uid_t uid = st->info.st_uid;
 
-	check_globicon(path, item);
-
-	if (item->flags & ITEM_FLAG_MOUNT_POINT)
-	{
-		item->mime_type = inode_mountpoint;
+	if (st->flags & ITEM_FLAG_MOUNT_POINT)
 		return;		/* Try to avoid automounter problems */
-	}
 
-	if (link_target->st_mode & S_IWOTH)
+	if (st->info.st_mode & S_IWOTH)
 		return;		/* Don't trust world-writable dirs */
 
-	/* Finding the icon:
-	 *
-	 * - If it contains a .DirIcon then that's the icon
-	 * - If it contains an AppRun then it's an application
-	 * - If it contains an AppRun but no .DirIcon then try to
-	 *   use AppIcon.xpm as the icon.
-	 *
-	 * .DirIcon and AppRun must have the same owner as the
-	 * directory itself, to prevent abuse of /tmp, etc.
-	 * For symlinks, we want the symlink's owner.
-	 */
-
+	tmp = g_string_new(NULL);
 	g_string_printf(tmp, "%s/.DirIcon", path);
 
-	if (item->_image)
-		goto no_diricon;	/* Already got an icon */
-
 	if (mc_lstat(tmp->str, &info) != 0 || info.st_uid != uid)
 		goto no_diricon;	/* Missing, or wrong owner */
 
@@ -307,8 +435,7 @@ static void examine_dir(const guchar *path, DirItem *item,
 	if (info.st_size > MAX_ICON_SIZE || !S_ISREG(info.st_mode))
 		goto no_diricon;	/* Too big, or non-regular file */
 
-	/* Try to load image; may still get NULL... */
-	item->_image = g_fscache_lookup(pixmap_cache, tmp->str);
+	st->icons |= DIR_STAT_DIRICON;
 
 no_diricon:
 
@@ -322,12 +449,9 @@ no_diricon:
 	if (!(info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
 		goto out;	/* Not executable */
 
-	item->flags |= ITEM_FLAG_APPDIR;
-
-	/* Try to load AppIcon.xpm... */
+	st->flags |= ITEM_FLAG_APPDIR;
 
-	if (item->_image)
-		goto out;	/* Already got an icon */
+	/* Check AppIcon.xpm, in case .DirIcon fails to load... */
 
 	g_string_truncate(tmp, tmp->len - 3);
 	g_string_append(tmp, "Icon.xpm");
@@ -342,10 +466,45 @@ no_diricon:
 	if (info.st_size > MAX_ICON_SIZE || !S_ISREG(info.st_mode))
 		goto out;	/* Too big, or non-regular file */
 
-	/* Try to load image; may still get NULL... */
-	item->_image = g_fscache_lookup(pixmap_cache, tmp->str);
+	st->icons |= DIR_STAT_APPICON;
 
 out:
+	g_string_free(tmp, TRUE);
+}
+
+/* Set item->_image from the file 'leaf' inside the directory 'path' */
+static void load_dir_icon(const guchar *path, const char *leaf, DirItem *item)
+{
+	gchar *icon_path;
+
+	/* (path may be make_path()'s buffer, so don't use that here) */
+	icon_path = g_strconcat(path, leaf, NULL);
+	item->_image = g_fscache_lookup(pixmap_cache, icon_path);
+	g_free(icon_path);
+}
+
+/* Fill in more details of the DirItem for a directory item.
+ * - Looks for an image (but maybe still NULL on error)
+ *
+ * st contains the results of collect_dir().
+ */
+static void examine_dir(const guchar *path, DirItem *item, DirItemStat *st)
+{
+	check_globicon(path, item);
+
+	if (item->flags & ITEM_FLAG_MOUNT_POINT)
+	{
+		item->mime_type = inode_mountpoint;
+		return;
+	}
+
+	/* Try to load image; may still get NULL... */
+	if (!item->_image && (st->icons & DIR_STAT_DIRICON))
+		load_dir_icon(path, "/.DirIcon", item);
+
+	/* Try to load AppIcon.xpm... */
+	if (!item->_image && (st->icons & DIR_STAT_APPICON))
+		load_dir_icon(path, "/AppIcon.xpm", item);
 
 	if ((item->flags & ITEM_FLAG_APPDIR) && !item->_image)
 	{
@@ -9,6 +9,11 @@
 
 #include <sys/types.h>
 
+/* Check whether items can be restatted relative to their directory */
+#if defined(HAVE_FSTATAT) && !defined(HAVE_LIBVFS)
+# define USE_FSTATAT
+#endif
+
 extern time_t diritem_recent_time;
 
 typedef enum
@@ -18,7 +23,7 @@ typedef enum
 	ITEM_FLAG_MOUNT_POINT  	= 0x04,	/* Is mounted or in fstab */
 	ITEM_FLAG_MOUNTED  	= 0x08,	/* Is mounted */
 	ITEM_FLAG_EXEC_FILE  	= 0x20,	/* File, and has an X bit set (or is a .desktop)*/
-	ITEM_FLAG_MAY_DELETE	= 0x40, /* Delete on finishing scan */
+	ITEM_FLAG_MAY_DELETE	= 0x40, /* Not yet found, this scan */
 	ITEM_FLAG_RECENT	= 0x80, /* [MC]-time is around now */
 
 	/* DirItems are created with this flag set. Restatting or queuing an
@@ -28,30 +33,62 @@ typedef enum
 	ITEM_FLAG_NEED_RESCAN_QUEUE = 0x100,
 	
 	ITEM_FLAG_HAS_XATTR      = 0x200, /* Has extended attributes set */
+	ITEM_FLAG_STAT_PENDING	= 0x400, /* Slow mount point, still being statted */
 } ItemFlags;
 
+/* A DirItem and its leafname are allocated as a single block by
+ * diritem_new(). Fields are ordered to avoid padding.
+ */
 struct _DirItem
 {
 	char		*leafname;
-	CollateKey	*leafname_collate; /* Preprocessed for sorting */
-	gboolean	may_delete;	/* Not yet found, this scan */
-	int		base_type;
-	int		flags;
-	mode_t		mode;
-	off_t		size;
-	time_t		atime, ctime, mtime;
+	CollateKey	*_collate;	/* NULL => not needed yet */
 	MaskedPixmap	*_image;	/* NULL => leafname only so far */
 	MIME_type	*mime_type;
+	off_t		size;
+	time_t		atime, ctime, mtime;
+	mode_t		mode;
 	uid_t		uid;
 	gid_t		gid;
+	int		base_type;
+	int		flags;
 	int		lstat_errno;	/* 0 if details are valid */
 };
 
+/* The results of the system calls needed to bring a DirItem up-to-date.
+ * Any thread may collect these with diritem_stat_collect(), but only the
+ * main thread may apply them to a DirItem with diritem_restat_apply().
+ */
+typedef struct _DirItemStat DirItemStat;
+
+struct _DirItemStat
+{
+	int		lstat_errno;	/* 0 if lstat_info is valid */
+	int		stat_errno;	/* Symlinks only; 0 if info is valid */
+	struct stat	lstat_info;	/* The item itself */
+	struct stat	info;		/* The link's target (or the item) */
+	gchar		*target_path;	/* Symlinks only; realpath() */
+	gchar		*mime_name;	/* Files only; NULL if unknown */
+	int		flags;		/* ITEM_FLAG_* found so far */
+	int		icons;		/* Internal use */
+};
+
 void diritem_init(void);
 DirItem *diritem_new(const guchar *leafname);
 void diritem_restat(const guchar *path, DirItem *item, struct stat *parent);
+void diritem_restat_at(const guchar *path, int dir_fd,
+		       DirItem *item, struct stat *parent);
+void diritem_stat_collect(const guchar *path, int dir_fd,
+			  const guchar *leafname, struct stat *parent,
+			  DirItemStat *st);
+void diritem_restat_apply(const guchar *path, DirItem *item, DirItemStat *st);
+void diritem_stat_clear(DirItemStat *st);
 void _diritem_get_image(DirItem *item);
+void _diritem_get_collate(DirItem *item);
 void diritem_free(DirItem *item);
+gsize diritem_size(DirItem *item);
+void diritem_drop_collate(DirItem *item);
+void diritem_mount_pending(DirItem *item);
 
 static inline MaskedPixmap *di_image(DirItem *item)
 {
@@ -60,4 +97,14 @@ static inline MaskedPixmap *di_image(DirItem *item)
 	return item->_image;
 }
 
+/* The leafname, preprocessed for sorting. Only built when first needed,
+ * since most sorts never compare names.
+ */
+static inline CollateKey *di_collate(DirItem *item)
+{
+	if (!item->_collate)
+		_diritem_get_collate(item);
+	return item->_collate;
+}
+
 #endif /* _DIRITEM_H */
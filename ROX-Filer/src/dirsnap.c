@@ -0,0 +1,501 @@
+/*
+ * ROX-Filer, filer for the ROX desktop project
+ * Copyright (C) 2006, Thomas Leonard and others (see changelog for details).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* dirsnap.c - remember what was in large directories between runs
+ *
+ * When a large directory has been scanned, the details of its DirItems are
+ * saved to a file in the user's cache directory. Next time the directory
+ * is opened (even by another process), the saved items are shown straight
+ * away, fully typed, while the usual scan checks them in the background.
+ *
+ * A snapshot is only used if the directory's device, inode and mtime
+ * still match, so it is rarely wrong, and never for long. Snapshots which
+ * don't match are deleted when found, and the first save in each run
+ * deletes any which haven't been used for a while.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include "global.h"
+
+#include "dirsnap.h"
+#include "diritem.h"
+#include "support.h"
+#include "type.h"
+
+/* Smaller directories are quick enough to scan anyway */
+#define DIRSNAP_MIN_ITEMS 100
+
+/* Snapshots not used for this long are deleted (in seconds) */
+#define DIRSNAP_MAX_AGE (30 * 24 * 60 * 60)
+
+/* If the snapshots take up more than this, the least recently used ones
+ * are deleted (in bytes)
+ */
+#define DIRSNAP_MAX_TOTAL (64 * 1024 * 1024)
+
+/* Other files in the snapshot directory are deleted once they're this
+ * old (in seconds)
+ */
+#define DIRSNAP_TEMP_AGE (60 * 60)
+
+#define SNAP_MAGIC "ROXDIR01"
+#define NO_STRING ((guint32) -1)
+
+typedef struct _SnapHeader SnapHeader;
+typedef struct _SnapItem SnapItem;
+typedef struct _SnapBuilder SnapBuilder;
+typedef struct _SnapFile SnapFile;
+
+/* A snapshot file is a SnapHeader, then n_items SnapItems, then
+ * strings_len bytes of nul-terminated strings. It is only read on the
+ * machine that wrote it, so native byte order is used.
+ */
+struct _SnapHeader
+{
+	char	magic[8];
+	guint32	n_items;
+	guint32	strings_len;
+
+	/* The directory, as it was when scanned */
+	guint64	dev, ino;
+	gint64	mtime;
+};
+
+struct _SnapItem
+{
+	guint32	name;		/* Offset of the leafname in the strings */
+	guint32	mime_type;	/* Offset of "media/subtype", or NO_STRING */
+	gint32	base_type;
+	gint32	flags;
+	guint32	mode, uid, gid, unused;
+	gint64	size, atime, ctime, mtime;
+};
+
+struct _SnapBuilder
+{
+	GByteArray	*items;
+	GString		*strings;
+};
+
+/* A snapshot found by prune_snapshots() */
+struct _SnapFile
+{
+	gchar	*path;
+	time_t	used;
+	off_t	size;
+};
+
+/* Static prototypes */
+static gchar *snapshot_dir(void);
+static gchar *snapshot_path(const char *pathname, gboolean create);
+static gboolean snapshot_matches(const SnapHeader *header,
+				 const struct stat *info);
+static gboolean snapshot_current(const gchar *path, const struct stat *info);
+static void add_item(gpointer key, gpointer value, gpointer data);
+static void prune_snapshots(void);
+static gint cmp_used(gconstpointer a, gconstpointer b);
+static gboolean is_snapshot_name(const char *leaf);
+
+
+/****************************************************************
+ *			EXTERNAL INTERFACE			*
+ ****************************************************************/
+
+/* Returns a new array of DirItems saved for this directory, or NULL if
+ * there is no up-to-date snapshot. The items still need restatting.
+ */
+GPtrArray *dirsnap_load(const char *pathname)
+{
+	struct stat	info, snap_info;
+	const SnapHeader *header;
+	const SnapItem	*snap_items;
+	const char	*strings;
+	GPtrArray	*items;
+	gchar		*path;
+	gpointer	map;
+	guint32		i;
+	int		fd;
+
+	if (mc_stat(pathname, &info))
+		return NULL;
+
+	path = snapshot_path(pathname, FALSE);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		g_free(path);
+		return NULL;
+	}
+
+	if (fstat(fd, &snap_info) || snap_info.st_size < sizeof(SnapHeader))
+	{
+		close(fd);
+		unlink(path);
+		g_free(path);
+		return NULL;
+	}
+
+	map = mmap(NULL, snap_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		g_free(path);
+		return NULL;
+	}
+
+	header = map;
+	snap_items = (SnapItem *) (header + 1);
+	strings = (char *) (snap_items + header->n_items);
+
+	if (!snapshot_matches(header, &info) ||
+	    sizeof(SnapHeader) + (guint64) header->n_items * sizeof(SnapItem)
+	    + header->strings_len != snap_info.st_size ||
+	    header->strings_len == 0 ||
+	    strings[header->strings_len - 1] != '\0')
+	{
+		/* Out-of-date or corrupted; it will never be any use */
+		munmap(map, snap_info.st_size);
+		unlink(path);
+		g_free(path);
+		return NULL;
+	}
+	g_free(path);
+
+	items = g_ptr_array_sized_new(header->n_items);
+
+	for (i = 0; i < header->n_items; i++)
+	{
+		const SnapItem *snap = &snap_items[i];
+		DirItem	*item;
+
+		if (snap->name >= header->strings_len ||
+		    (snap->mime_type != NO_STRING &&
+		     snap->mime_type >= header->strings_len))
+			continue;	/* Corrupted */
+
+		item = diritem_new(strings + snap->name);
+		item->base_type = snap->base_type;
+		item->flags = (snap->flags & ~ITEM_FLAG_MAY_DELETE) |
+				ITEM_FLAG_NEED_RESCAN_QUEUE;
+		item->mode = snap->mode;
+		item->uid = snap->uid;
+		item->gid = snap->gid;
+		item->size = snap->size;
+		item->atime = snap->atime;
+		item->ctime = snap->ctime;
+		item->mtime = snap->mtime;
+		item->lstat_errno = 0;
+		if (snap->mime_type != NO_STRING)
+			item->mime_type =
+				mime_type_lookup(strings + snap->mime_type);
+
+		g_ptr_array_add(items, item);
+	}
+
+	munmap(map, snap_info.st_size);
+
+	return items;
+}
+
+/* The directory 'pathname' has just been scanned. 'info' is its stat
+ * details from before the scan, and 'items' maps leafnames to DirItems.
+ * Saves a snapshot if the directory is large enough to be worth it and
+ * the saved one (if any) is out-of-date.
+ */
+void dirsnap_save(const char *pathname, const struct stat *info,
+		  GHashTable *items)
+{
+	static gboolean	pruned = FALSE;
+	SnapBuilder	builder;
+	SnapHeader	header;
+	GByteArray	*contents;
+	gchar		*path;
+
+	if (g_hash_table_size(items) < DIRSNAP_MIN_ITEMS)
+		return;
+
+	path = snapshot_path(pathname, TRUE);
+	if (!path)
+		return;
+
+	if (snapshot_current(path, info))
+	{
+		g_free(path);
+		return;
+	}
+
+	builder.items = g_byte_array_new();
+	builder.strings = g_string_new(NULL);
+	g_hash_table_foreach(items, add_item, &builder);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAP_MAGIC, sizeof(header.magic));
+	header.n_items = builder.items->len / sizeof(SnapItem);
+	header.strings_len = builder.strings->len;
+	header.dev = info->st_dev;
+	header.ino = info->st_ino;
+	header.mtime = info->st_mtime;
+
+	contents = g_byte_array_new();
+	g_byte_array_append(contents, (guint8 *) &header, sizeof(header));
+	g_byte_array_append(contents, builder.items->data, builder.items->len);
+	g_byte_array_append(contents, (guint8 *) builder.strings->str,
+			    builder.strings->len);
+
+	/* (writes to a temporary file and renames, so readers never see
+	 * a partial snapshot)
+	 */
+	g_file_set_contents(path, (gchar *) contents->data, contents->len, NULL);
+
+	g_byte_array_free(contents, TRUE);
+	g_byte_array_free(builder.items, TRUE);
+	g_string_free(builder.strings, TRUE);
+	g_free(path);
+
+	if (!pruned)
+	{
+		pruned = TRUE;
+		prune_snapshots();
+	}
+}
+
+/****************************************************************
+ *			INTERNAL FUNCTIONS			*
+ ****************************************************************/
+
+/* The directory holding all the snapshots. g_free() the result. */
+static gchar *snapshot_dir(void)
+{
+	return g_build_filename(g_get_user_cache_dir(),
+				"rox.sourceforge.net", "ROX-Filer", "dirs",
+				NULL);
+}
+
+/* Where the snapshot for 'pathname' is kept. If 'create' is set, make the
+ * directory for it (returning NULL on failure). g_free() the result.
+ */
+static gchar *snapshot_path(const char *pathname, gboolean create)
+{
+	gchar	*dir, *hash, *path;
+
+	dir = snapshot_dir();
+
+	/* The names in a directory may be private */
+	if (create && g_mkdir_with_parents(dir, 0700))
+	{
+		g_free(dir);
+		return NULL;
+	}
+
+	hash = md5_hash(pathname);
+	path = g_build_filename(dir, hash, NULL);
+	g_free(hash);
+	g_free(dir);
+
+	return path;
+}
+
+/* TRUE if this snapshot was taken of the directory 'info' as it is now */
+static gboolean snapshot_matches(const SnapHeader *header,
+				 const struct stat *info)
+{
+	return memcmp(header->magic, SNAP_MAGIC, sizeof(header->magic)) == 0
+		&& header->dev == info->st_dev
+		&& header->ino == info->st_ino
+		&& header->mtime == info->st_mtime;
+}
+
+/* TRUE if the snapshot at 'path' is of the directory 'info' as it is now.
+ * Avoids rewriting snapshots each time a directory is rescanned.
+ */
+static gboolean snapshot_current(const gchar *path, const struct stat *info)
+{
+	SnapHeader	header;
+	gssize		got;
+	int		fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return FALSE;
+
+	got = read(fd, &header, sizeof(header));
+	close(fd);
+
+	return got == sizeof(header) && snapshot_matches(&header, info);
+}
+
+static void add_item(gpointer key, gpointer value, gpointer data)
+{
+	SnapBuilder	*builder = (SnapBuilder *) data;
+	DirItem		*item = (DirItem *) value;
+	SnapItem	snap;
+
+	memset(&snap, 0, sizeof(snap));
+
+	snap.name = builder->strings->len;
+	g_string_append_len(builder->strings, item->leafname,
+			    strlen(item->leafname) + 1);
+
+	/* Items we never managed to stat are saved as placeholders */
+	if (item->lstat_errno || item->base_type == TYPE_ERROR ||
+	    item->flags & ITEM_FLAG_STAT_PENDING)
+		snap.base_type = TYPE_UNKNOWN;
+	else
+		snap.base_type = item->base_type;
+
+	snap.mime_type = NO_STRING;
+	if (item->mime_type && snap.base_type != TYPE_UNKNOWN)
+	{
+		snap.mime_type = builder->strings->len;
+		g_string_append_printf(builder->strings, "%s/%s",
+				       item->mime_type->media_type,
+				       item->mime_type->subtype);
+		g_string_append_c(builder->strings, '\0');
+	}
+
+	if (snap.base_type != TYPE_UNKNOWN)
+	{
+		snap.flags = item->flags;
+		snap.mode = item->mode;
+		snap.uid = item->uid;
+		snap.gid = item->gid;
+		snap.size = item->size;
+		snap.atime = item->atime;
+		snap.ctime = item->ctime;
+		snap.mtime = item->mtime;
+	}
+
+	g_byte_array_append(builder->items, (guint8 *) &snap, sizeof(snap));
+}
+
+/* Delete snapshots which haven't been used for DIRSNAP_MAX_AGE, and then
+ * the least recently used ones until they fit in DIRSNAP_MAX_TOTAL. Also
+ * removes temporary files left by g_file_set_contents() ("<hash>.XXXXXX")
+ * which are more than DIRSNAP_TEMP_AGE old (newer ones may still be being
+ * written by another process).
+ * Snapshots are read with mmap(), so the access time may not be updated
+ * on every use; it's only a hint.
+ */
+static void prune_snapshots(void)
+{
+	GArray	*files;
+	gchar	*path;
+	DIR	*dir;
+	struct dirent *ent;
+	guint64	total = 0;
+	time_t	now;
+	guint	i;
+
+	path = snapshot_dir();
+	dir = opendir(path);
+	if (!dir)
+	{
+		g_free(path);
+		return;
+	}
+
+	time(&now);
+	files = g_array_new(FALSE, FALSE, sizeof(SnapFile));
+
+	while ((ent = readdir(dir)))
+	{
+		struct stat	info;
+		SnapFile	file;
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		file.path = g_build_filename(path, ent->d_name, NULL);
+		if (lstat(file.path, &info) || !S_ISREG(info.st_mode))
+		{
+			g_free(file.path);
+			continue;
+		}
+
+		file.used = MAX(info.st_atime, info.st_mtime);
+		file.size = info.st_size;
+
+		if (!is_snapshot_name(ent->d_name))
+		{
+			if (info.st_mtime < now - DIRSNAP_TEMP_AGE)
+				unlink(file.path);
+			g_free(file.path);
+			continue;
+		}
+
+		if (file.used < now - DIRSNAP_MAX_AGE)
+		{
+			unlink(file.path);
+			g_free(file.path);
+			continue;
+		}
+
+		total += file.size;
+		g_array_append_val(files, file);
+	}
+
+	closedir(dir);
+
+	g_array_sort(files, cmp_used);
+
+	for (i = 0; i < files->len; i++)
+	{
+		SnapFile *file = &g_array_index(files, SnapFile, i);
+
+		if (total > DIRSNAP_MAX_TOTAL)
+		{
+			unlink(file->path);
+			total -= file->size;
+		}
+		g_free(file->path);
+	}
+
+	g_array_free(files, TRUE);
+	g_free(path);
+}
+
+/* Least recently used SnapFiles first */
+static gint cmp_used(gconstpointer a, gconstpointer b)
+{
+	const SnapFile *fa = (const SnapFile *) a;
+	const SnapFile *fb = (const SnapFile *) b;
+
+	return fa->used < fb->used ? -1 : fa->used > fb->used;
+}
+
+/* TRUE if 'leaf' could be a snapshot's name (see snapshot_path()) */
+static gboolean is_snapshot_name(const char *leaf)
+{
+	int	i;
+
+	for (i = 0; i < 32; i++)
+		if (!g_ascii_isxdigit(leaf[i]))
+			return FALSE;
+
+	return leaf[32] == '\0';
+}
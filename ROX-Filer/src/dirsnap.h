@@ -0,0 +1,15 @@
+/*
+ * ROX-Filer, filer for the ROX desktop project
+ * Thomas Leonard, <tal197@users.sourceforge.net>
+ */
+
+#ifndef _DIRSNAP_H
+#define _DIRSNAP_H
+
+#include <sys/stat.h>
+
+GPtrArray *dirsnap_load(const char *pathname);
+void dirsnap_save(const char *pathname, const struct stat *info,
+		  GHashTable *items);
+
+#endif /* _DIRSNAP_H */
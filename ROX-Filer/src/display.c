@@ -71,6 +71,7 @@ Option o_display_show_hidden;
 Option o_display_show_thumbs;
 Option o_display_show_headers;
 Option o_display_show_full_type;
+Option o_display_fixed_rows;
 Option o_display_inherit_options;
 static Option o_filer_change_size_num;
 Option o_vertical_order_small, o_vertical_order_large;
@@ -82,6 +83,8 @@ static void display_style_set(FilerWindow *filer_window, DisplayStyle style);
 static void options_changed(void);
 static char *details(FilerWindow *filer_window, DirItem *item);
 static void display_set_actual_size_real(FilerWindow *filer_window);
+static gboolean shows_owners(FilerWindow *filer_window);
+static void owners_found(GHashTable *uids, GHashTable *gids);
 
 /****************************************************************
  *			EXTERNAL INTERFACE			*
@@ -100,6 +103,7 @@ void display_init()
 	option_add_int(&o_display_show_thumbs, "display_show_thumbs", FALSE);
 	option_add_int(&o_display_show_headers, "display_show_headers", TRUE);
 	option_add_int(&o_display_show_full_type, "display_show_full_type", FALSE);
+	option_add_int(&o_display_fixed_rows, "display_fixed_rows", 5000);
 	option_add_int(&o_display_inherit_options,
 		       "display_inherit_options", FALSE); 
 	option_add_int(&o_filer_change_size_num, "filer_change_size_num", 30); 
@@ -108,6 +112,8 @@ void display_init()
 	option_add_int(&o_xattr_show, "xattr_show", TRUE);
 
 	option_add_notify(options_changed);
+
+	set_id_names_func(owners_found);
 }
 
 void draw_emblem_on_icon(GdkWindow *window, GtkStyle   *style,
@@ -334,13 +340,13 @@ int sort_by_name(const void *item1, const void *item2)
 {
 	const DirItem *i1 = (DirItem *) item1;
 	const DirItem *i2 = (DirItem *) item2;
-	CollateKey *n1 = i1->leafname_collate;
-	CollateKey *n2 = i2->leafname_collate;
 	int retval;
 
 	SORT_DIRS;
 
-	retval = collate_key_cmp(n1, n2, o_display_caps_first.int_value);
+	retval = collate_key_cmp(di_collate((DirItem *) i1),
+				 di_collate((DirItem *) i2),
+				 o_display_caps_first.int_value);
 
 	return retval ? retval : strcmp(i1->leafname, i2->leafname);
 }
@@ -445,9 +451,55 @@ void display_set_sort_type(FilerWindow *filer_window, SortType sort_type,
 	filer_window->sort_type = sort_type;
 	filer_window->sort_order = order;
 
+	display_prefetch_owners(filer_window, NULL);
 	view_sort(filer_window->view);
 }
 
+/* If this window shows or sorts by owners or groups, start looking up the
+ * names for all these items at once (or for all items in the window if
+ * 'items' is NULL), rather than one at a time as they are drawn or
+ * compared. The items are updated when the names arrive.
+ */
+void display_prefetch_owners(FilerWindow *filer_window, GPtrArray *items)
+{
+	GArray	*uids, *gids;
+	DirItem	*item;
+	ViewIter iter;
+	int	i;
+
+	if (!shows_owners(filer_window))
+		return;
+
+	if (!items)
+	{
+		items = g_ptr_array_new();
+		view_get_iter(filer_window->view, &iter, 0);
+		while ((item = iter.next(&iter)))
+			g_ptr_array_add(items, item);
+		display_prefetch_owners(filer_window, items);
+		g_ptr_array_free(items, TRUE);
+		return;
+	}
+
+	uids = g_array_new(FALSE, FALSE, sizeof(uid_t));
+	gids = g_array_new(FALSE, FALSE, sizeof(gid_t));
+
+	for (i = 0; i < items->len; i++)
+	{
+		item = (DirItem *) items->pdata[i];
+		if (item->base_type == TYPE_UNKNOWN)
+			continue;	/* Not statted yet */
+		g_array_append_val(uids, item->uid);
+		g_array_append_val(gids, item->gid);
+	}
+
+	prefetch_id_names((uid_t *) uids->data, uids->len,
+			  (gid_t *) gids->data, gids->len);
+
+	g_array_free(uids, TRUE);
+	g_array_free(gids, TRUE);
+}
+
 /* Change the icon size and style.
  * force_resize should only be TRUE for new windows.
  */
@@ -619,6 +671,49 @@ void display_set_actual_size(FilerWindow *filer_window, gboolean force_resize)
  *			INTERNAL FUNCTIONS			*
  ****************************************************************/
 
+/* TRUE if this window shows or sorts by owners or groups */
+static gboolean shows_owners(FilerWindow *filer_window)
+{
+	return filer_window->view_type == VIEW_TYPE_DETAILS ||
+	       filer_window->details_type == DETAILS_PERMISSIONS ||
+	       filer_window->sort_type == SORT_OWNER ||
+	       filer_window->sort_type == SORT_GROUP;
+}
+
+/* Called when display_prefetch_owners() has found the names for these
+ * ids. Redraw (and resort) the items which use them.
+ */
+static void owners_found(GHashTable *uids, GHashTable *gids)
+{
+	GList	*next;
+
+	for (next = all_filer_windows; next; next = next->next)
+	{
+		FilerWindow *filer_window = (FilerWindow *) next->data;
+		GPtrArray *items;
+		DirItem	*item;
+		ViewIter iter;
+
+		if (!shows_owners(filer_window))
+			continue;
+
+		items = g_ptr_array_new();
+		view_get_iter(filer_window->view, &iter, 0);
+		while ((item = iter.next(&iter)))
+		{
+			if (g_hash_table_lookup_extended(uids,
+				GUINT_TO_POINTER(item->uid), NULL, NULL) ||
+			    g_hash_table_lookup_extended(gids,
+				GUINT_TO_POINTER(item->gid), NULL, NULL))
+				g_ptr_array_add(items, item);
+		}
+
+		if (items->len)
+			view_update_items(filer_window->view, items);
+		g_ptr_array_free(items, TRUE);
+	}
+}
+
 static void options_changed(void)
 {
 	GList		*next;
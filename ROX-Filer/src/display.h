@@ -30,6 +30,7 @@ struct _ViewData
 extern Option o_display_inherit_options, o_display_sort_by;
 extern Option o_display_size, o_display_details, o_display_show_hidden;
 extern Option o_display_show_headers, o_display_show_full_type;
+extern Option o_display_fixed_rows;
 extern Option o_display_show_thumbs;
 extern Option o_small_width;
 extern Option o_vertical_order_small, o_vertical_order_large;
@@ -54,6 +55,7 @@ int sort_by_owner(const void *item1, const void *item2);
 int sort_by_group(const void *item1, const void *item2);
 void display_set_sort_type(FilerWindow *filer_window, SortType sort_type,
 			   GtkSortType order);
+void display_prefetch_owners(FilerWindow *filer_window, GPtrArray *items);
 void display_set_autoselect(FilerWindow *filer_window, const gchar *leaf);
 
 void draw_large_icon(GdkWindow *window,
@@ -139,7 +139,8 @@ static void filer_add_widgets(FilerWindow *filer_window, const gchar *wm_class);
 static void filer_add_signals(FilerWindow *filer_window);
 
 static void set_selection_state(FilerWindow *filer_window, gboolean normal);
-static void filer_next_thumb(GObject *window, const gchar *path);
+static void filer_thumb_done(FilerWindow *filer_window, const gchar *path);
+static void filer_scrolled(GtkRange *range, FilerWindow *filer_window);
 static void start_thumb_scanning(FilerWindow *filer_window);
 static void filer_options_changed(void);
 static void drag_end(GtkWidget *widget, GdkDragContext *context,
@@ -177,6 +178,11 @@ Option o_filer_size_limit;
 
 #define ROX_RESPONSE_EJECT 99 /**< User clicked on Eject button */
 
+/* How long (ms) scrolling must stop for before the thumbnails are
+ * reprioritised.
+ */
+#define THUMB_REORDER_DELAY 200
+
 void filer_init(void)
 {
 	const gchar *ohost;
@@ -392,6 +398,7 @@ static void update_display(Directory *dir,
 	switch (action)
 	{
 		case DIR_ADD:
+			display_prefetch_owners(filer_window, items);
 			view_add_items(view, items);
 			/* Open and resize if currently hidden */
 			open_filer_window(filer_window);
@@ -430,10 +437,11 @@ static void update_display(Directory *dir,
 
 			filer_create_thumbs(filer_window);
 
-			if (filer_window->thumb_queue)
+			if (filer_window->thumbs_pending)
 				start_thumb_scanning(filer_window);
 			break;
 		case DIR_UPDATE:
+			display_prefetch_owners(filer_window, items);
 			view_update_items(view, items);
 			break;
 		case DIR_ERROR_CHANGED:
@@ -706,8 +714,7 @@ static void filer_window_destroyed(GtkWidget *widget, FilerWindow *filer_window)
 		filer_window->auto_scroll = -1;
 	}
 
-	if (filer_window->thumb_queue)
-		destroy_glist(&filer_window->thumb_queue);
+	filer_cancel_thumbnails(filer_window);
 
 	tooltip_show(NULL);
 
@@ -1504,8 +1511,9 @@ FilerWindow *filer_opendir(const char *path, FilerWindow *src_win,
 	filer_window->details_type = DETAILS_TIMES;
 	filer_window->display_style = UNKNOWN_STYLE;
 	filer_window->display_style_wanted = UNKNOWN_STYLE;
-	filer_window->thumb_queue = NULL;
+	filer_window->thumbs_pending = 0;
 	filer_window->max_thumbs = 0;
+	filer_window->thumb_reorder = 0;
 	filer_window->sort_type = -1;
 
 	filer_window->filter = FILER_SHOW_ALL;
@@ -1744,6 +1752,8 @@ static void filer_add_widgets(FilerWindow *filer_window, const gchar *wm_class)
 
 	/* Create this now to make the Adjustment before the View */
 	filer_window->scrollbar = gtk_vscrollbar_new(NULL);
+	g_signal_connect(filer_window->scrollbar, "value-changed",
+			 G_CALLBACK(filer_scrolled), filer_window);
 
 	vbox = gtk_vbox_new(FALSE, 0);
 	gtk_container_add(GTK_CONTAINER(filer_window->window), vbox);
@@ -2214,62 +2224,61 @@ void filer_cancel_thumbnails(FilerWindow *filer_window)
 {
 	gtk_widget_hide(filer_window->thumb_bar);
 
-	destroy_glist(&filer_window->thumb_queue);
+	pixmap_cancel_thumbs(filer_window);
+	filer_window->thumbs_pending = 0;
 	filer_window->max_thumbs = 0;
-}
-
-/* Generate the next thumb for this window. The window object is
- * unref'd when there is nothing more to do.
- * If the window no longer has a filer window, nothing is done.
- */
-static gboolean filer_next_thumb_real(GObject *window)
-{
-	FilerWindow *filer_window;
-	gchar	*path;
-	int	done, total;
 
-	filer_window = g_object_get_data(window, "filer_window");
-
-	if (!filer_window)
-	{
-		g_object_unref(window);
-		return FALSE;
-	}
-		
-	if (!filer_window->thumb_queue)
+	if (filer_window->thumb_reorder)
 	{
-		filer_cancel_thumbnails(filer_window);
-		g_object_unref(window);
-		return FALSE;
+		g_source_remove(filer_window->thumb_reorder);
+		filer_window->thumb_reorder = 0;
 	}
+}
 
-	total = filer_window->max_thumbs;
-	done = total - g_list_length(filer_window->thumb_queue);
-
-	path = (gchar *) filer_window->thumb_queue->data;
+static gboolean reorder_thumbs(gpointer data)
+{
+	FilerWindow *filer_window = (FilerWindow *) data;
 
-	pixmap_background_thumb(path, (GFunc) filer_next_thumb, window);
+	filer_window->thumb_reorder = 0;
+	filer_create_thumbs(filer_window);
 
-	filer_window->thumb_queue = g_list_remove(filer_window->thumb_queue,
-						  path);
-	g_free(path);
+	return FALSE;
+}
 
-	gtk_progress_bar_set_fraction(
-			GTK_PROGRESS_BAR(filer_window->thumb_progress),
-			done / (float) total);
+/* The view has been scrolled. Once it settles down, give the thumbnails
+ * that are now visible priority over the ones that aren't.
+ */
+static void filer_scrolled(GtkRange *range, FilerWindow *filer_window)
+{
+	if (!filer_window->thumbs_pending)
+		return;
 
-	return FALSE;
+	if (filer_window->thumb_reorder)
+		g_source_remove(filer_window->thumb_reorder);
+	filer_window->thumb_reorder = g_timeout_add(THUMB_REORDER_DELAY,
+						    reorder_thumbs,
+						    filer_window);
 }
 
-/* path is the thumb just loaded, if any.
- * window is unref'd (eventually).
+/* Called by the thumbnail scheduler. path is the thumb just loaded, or
+ * NULL if it couldn't be created.
  */
-static void filer_next_thumb(GObject *window, const gchar *path)
+static void filer_thumb_done(FilerWindow *filer_window, const gchar *path)
 {
+	int	total = filer_window->max_thumbs;
+
 	if (path)
 		dir_force_update_path(path);
 
-	g_idle_add((GSourceFunc) filer_next_thumb_real, window);
+	if (--filer_window->thumbs_pending == 0)
+	{
+		filer_cancel_thumbnails(filer_window);
+		return;
+	}
+
+	gtk_progress_bar_set_fraction(
+			GTK_PROGRESS_BAR(filer_window->thumb_progress),
+			(total - filer_window->thumbs_pending) / (float) total);
 }
 
 static void start_thumb_scanning(FilerWindow *filer_window)
@@ -2277,43 +2286,48 @@ static void start_thumb_scanning(FilerWindow *filer_window)
 	if (GTK_WIDGET_VISIBLE(filer_window->thumb_bar))
 		return;		/* Already scanning */
 
+	gtk_progress_bar_set_fraction(
+			GTK_PROGRESS_BAR(filer_window->thumb_progress), 0);
 	gtk_widget_show_all(filer_window->thumb_bar);
-
-	g_object_ref(G_OBJECT(filer_window->window));
-	filer_next_thumb(G_OBJECT(filer_window->window), NULL);
 }
 
-/* Set this image to be loaded some time in the future */
-void filer_create_thumb(FilerWindow *filer_window, const gchar *path)
+/* Set this image to be loaded some time in the future.
+ * Images with lower priority numbers are loaded first. If the image is
+ * already queued, its priority is changed.
+ */
+void filer_create_thumb(FilerWindow *filer_window, const gchar *path,
+			int priority)
 {
-	if (g_list_find_custom(filer_window->thumb_queue, path,
-			       (GCompareFunc) strcmp))
-		return;
+	if (!pixmap_background_thumb(path, priority,
+				     (GFunc) filer_thumb_done, filer_window))
+		return;		/* Already queued */
 
-	if (!filer_window->thumb_queue)
-		filer_window->max_thumbs=0;
+	if (!filer_window->thumbs_pending)
+		filer_window->max_thumbs = 0;
 	filer_window->max_thumbs++;
-
-	filer_window->thumb_queue = g_list_append(filer_window->thumb_queue,
-						  g_strdup(path));
+	filer_window->thumbs_pending++;
 
 	if (filer_window->scanning)
-		return;			/* Will start when scan ends */
+		return;			/* Will show progress when scan ends */
 
 	start_thumb_scanning(filer_window);
 }
 
 /* If thumbnail display is on, look through all the items in this directory
  * and start creating or updating the thumbnails as needed.
+ * Items nearest the visible part of the window are done first.
+ * Call this again after scrolling to update the priorities.
  */
 void filer_create_thumbs(FilerWindow *filer_window)
 {
 	DirItem *item;
 	ViewIter iter;
+	int	first, last;
 
 	if (!filer_window->show_thumbs)
 		return;
 
+	view_get_visible_limits(filer_window->view, &first, &last);
 	view_get_iter(filer_window->view, &iter, 0);
 
 	while ((item = iter.next(&iter)))
@@ -2345,7 +2359,9 @@ void filer_create_thumbs(FilerWindow *filer_window)
 		 *   FALSE, and we start creating the thumb here.
 		 */
 		if (!found)
-			filer_create_thumb(filer_window, path);
+			filer_create_thumb(filer_window, path,
+				view_visible_distance(filer_window->view,
+						      &iter, first, last));
 	}
 }
 
@@ -109,9 +109,10 @@ struct _FilerWindow
 	GtkStateType	selection_state;	/* for drawing selection */
 	
 	gboolean	show_thumbs;
-	GList		*thumb_queue;		/* paths to thumbnail */
+	int		thumbs_pending;		/* waiting for pixmap_background_thumb */
 	GtkWidget	*thumb_bar, *thumb_progress;
 	int		max_thumbs;		/* total for this batch */
+	gint		thumb_reorder;		/* Timeout to reprioritise */
 
 	gint		auto_scroll;		/* Timer */
 
@@ -147,7 +148,8 @@ void filer_target_mode(FilerWindow	*filer_window,
 			gpointer	data,
 			const char	*reason);
 GList *filer_selected_items(FilerWindow *filer_window);
-void filer_create_thumb(FilerWindow *filer_window, const gchar *pathname);
+void filer_create_thumb(FilerWindow *filer_window, const gchar *pathname,
+			int priority);
 void filer_cancel_thumbnails(FilerWindow *filer_window);
 void filer_set_title(FilerWindow *filer_window);
 void filer_create_thumbs(FilerWindow *filer_window);
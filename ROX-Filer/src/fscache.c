@@ -11,6 +11,17 @@
  * The actual data need not be the raw file contents - a user specified
  * function loads the file and associates data with the file in the cache.
  *
+ * A cache may be given a memory budget. The entries are kept on a list
+ * in the order they were last used, and the least recently used ones
+ * are dropped whenever the objects' total size goes over the budget.
+ * Entries which can't be dropped (in use elsewhere, or with no object)
+ * are set aside on a second list until they're used again or purged.
+ *
+ * Checking that a file hasn't changed costs a stat() on every lookup.
+ * A cache may instead trust files in directories which are being watched
+ * for changes (see g_fscache_trust_watched()). Those lookups are then
+ * just a couple of hash lookups, until the watcher says the file changed.
+ *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by the Free
  * Software Foundation; either version 2 of the License, or (at your option)
@@ -28,12 +39,15 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "global.h"
 
 #include "fscache.h"
 
 typedef struct _GFSCacheKey GFSCacheKey;
 typedef struct _GFSCacheData GFSCacheData;
+typedef struct _GFSCachePath GFSCachePath;
 
 struct _GFSCache
 {
@@ -41,6 +55,18 @@ struct _GFSCache
 	GFSLoadFunc	load;
 	GFSUpdateFunc	update;
 	gpointer	user_data;
+
+	/* Most recently used entry first */
+	GFSCacheData	*lru_head, *lru_tail;
+	GFSCacheData	*kept;		/* Set aside by keep_to_budget() */
+
+	GFSSizeFunc	size;		/* NULL => no budget */
+	GFSCacheStats	stats;
+
+	/* Pathname -> GFSCachePath, for files in watched directories.
+	 * NULL if this cache always stat()s.
+	 */
+	GHashTable	*trusted_paths;
 };
 
 struct _GFSCacheKey
@@ -49,11 +75,24 @@ struct _GFSCacheKey
 	ino_t		inode;
 };
 
+/* A path which was found to be this file, and which will still be
+ * until the directory watcher tells us otherwise.
+ */
+struct _GFSCachePath
+{
+	GFSCacheKey	key;
+};
+
 struct _GFSCacheData
 {
 	GObject		*data;		/* The object from the file */
 	time_t		last_lookup;
 
+	GFSCacheKey	*key;		/* Our key in inode_to_stats */
+	GFSCacheData	*lru_prev, *lru_next;
+	gboolean	kept;		/* On cache->kept, not the LRU list */
+	gsize		size;		/* As last reported by cache->size */
+
 	/* Details of the file last time we checked it */
 	time_t		m_time, c_time;
 	off_t		length;
@@ -76,6 +115,18 @@ static gboolean purge_hash_entry(gpointer key, gpointer data,
 				 gpointer user_data);
 static GFSCacheData *lookup_internal(GFSCache *cache, const char *pathname,
 					FSCacheLookup lookup_type);
+static void lru_unlink(GFSCache *cache, GFSCacheData *data);
+static void lru_push(GFSCache *cache, GFSCacheData *data);
+static void measure(GFSCache *cache, GFSCacheData *data);
+static void free_entry(GFSCache *cache, GFSCacheData *data);
+static void keep_to_budget(GFSCache *cache, GFSCacheData *keep);
+static void set_aside(GFSCache *cache, GFSCacheData *data);
+static void release_kept(GFSCache *cache);
+static GFSCacheData *lookup_trusted(GFSCache *cache, const char *pathname);
+static void trust_path(GFSCache *cache, const char *pathname,
+		       const GFSCacheKey *key);
+static void forget_path(gpointer data, gpointer user_data);
+static void forget_all_paths(gpointer data, gpointer user_data);
 
 
 struct PurgeInfo
@@ -85,6 +136,12 @@ struct PurgeInfo
 	time_t	 now;
 };
 
+/* Says whether a directory is being watched for changes */
+static GFSWatchedFunc is_watched = NULL;
+
+/* Caches using trusted_paths */
+static GList *trusting_caches = NULL;
+
 /****************************************************************
  *			EXTERNAL INTERFACE			*
  ****************************************************************/
@@ -114,6 +171,11 @@ GFSCache *g_fscache_new(GFSLoadFunc load,
 	cache->load = load;
 	cache->update = update;
 	cache->user_data = user_data;
+	cache->lru_head = cache->lru_tail = NULL;
+	cache->kept = NULL;
+	cache->size = NULL;
+	memset(&cache->stats, 0, sizeof(cache->stats));
+	cache->trusted_paths = NULL;
 
 	return cache;
 }
@@ -122,6 +184,12 @@ void g_fscache_destroy(GFSCache *cache)
 {
 	g_return_if_fail(cache != NULL);
 
+	if (cache->trusted_paths)
+	{
+		trusting_caches = g_list_remove(trusting_caches, cache);
+		g_hash_table_destroy(cache->trusted_paths);
+	}
+
 	g_hash_table_foreach(cache->inode_to_stats, destroy_hash_entry, NULL);
 	g_hash_table_destroy(cache->inode_to_stats);
 
@@ -166,6 +234,9 @@ void g_fscache_insert(GFSCache *cache, const char *pathname, gpointer obj,
 	if (data->data)
 		g_object_unref(data->data);
 	data->data = obj;
+
+	measure(cache, data);
+	keep_to_budget(cache, data);
 }
 
 /* As g_fscache_lookup, but 'lookup_type' controls what happens if the data
@@ -229,6 +300,8 @@ void g_fscache_may_update(GFSCache *cache, const char *pathname)
 		data->c_time = info.st_ctime;
 		data->length = info.st_size;
 		data->mode = info.st_mode;
+		measure(cache, data);
+		keep_to_budget(cache, data);
 	}
 }
 
@@ -258,6 +331,8 @@ void g_fscache_update(GFSCache *cache, const char *pathname)
 		data->c_time = info.st_ctime;
 		data->length = info.st_size;
 		data->mode = info.st_mode;
+		measure(cache, data);
+		keep_to_budget(cache, data);
 	}
 }
 
@@ -276,6 +351,89 @@ void g_fscache_purge(GFSCache *cache, gint age)
 
 	g_hash_table_foreach_remove(cache->inode_to_stats, purge_hash_entry,
 			(gpointer) &info);
+
+	release_kept(cache);
+}
+
+/* Limit the total size of the cached objects to 'budget' bytes (0 for
+ * no limit). size(object, user_data) gives the size of an object; it is
+ * called whenever an object is loaded, updated or used, so it may
+ * change over time. Objects in use elsewhere are never dropped, so the
+ * budget can be exceeded if they alone are too big.
+ */
+void g_fscache_set_budget(GFSCache *cache, gsize budget, GFSSizeFunc size)
+{
+	GFSCacheData *data;
+
+	g_return_if_fail(cache != NULL);
+
+	cache->size = budget ? size : NULL;
+	cache->stats.budget = budget;
+
+	cache->stats.size = 0;
+	for (data = cache->lru_head; data; data = data->lru_next)
+	{
+		data->size = 0;
+		measure(cache, data);
+	}
+	for (data = cache->kept; data; data = data->lru_next)
+	{
+		data->size = 0;
+		measure(cache, data);
+	}
+
+	keep_to_budget(cache, NULL);
+}
+
+void g_fscache_get_stats(GFSCache *cache, GFSCacheStats *stats)
+{
+	g_return_if_fail(cache != NULL);
+	g_return_if_fail(stats != NULL);
+
+	*stats = cache->stats;
+	stats->entries = g_hash_table_size(cache->inode_to_stats);
+}
+
+/* Don't stat() files in watched directories (see
+ * g_fscache_set_watched_func()) on lookup. Whoever is watching must call
+ * g_fscache_path_changed() and g_fscache_distrust_all() as needed.
+ * Files in other directories are checked as usual.
+ */
+void g_fscache_trust_watched(GFSCache *cache)
+{
+	g_return_if_fail(cache != NULL);
+
+	if (cache->trusted_paths)
+		return;
+
+	cache->trusted_paths = g_hash_table_new_full(g_str_hash, g_str_equal,
+						     g_free, g_free);
+	trusting_caches = g_list_prepend(trusting_caches, cache);
+}
+
+/* watched(dir) must return TRUE iff changes to any file in 'dir' (its
+ * contents, attributes, or being replaced) will be reported promptly.
+ */
+void g_fscache_set_watched_func(GFSWatchedFunc watched)
+{
+	is_watched = watched;
+	g_fscache_distrust_all();
+}
+
+/* The file at 'pathname' has changed, or may have been replaced. */
+void g_fscache_path_changed(const char *pathname)
+{
+	g_return_if_fail(pathname != NULL);
+
+	g_list_foreach(trusting_caches, forget_path, (gpointer) pathname);
+}
+
+/* Something has changed which could affect many paths (eg, a directory
+ * was renamed or is no longer watched). Check everything again.
+ */
+void g_fscache_distrust_all(void)
+{
+	g_list_foreach(trusting_caches, forget_all_paths, NULL);
 }
 
 
@@ -326,6 +484,9 @@ static gboolean purge_hash_entry(gpointer key, gpointer data,
 		&& cache_data->last_lookup >= info->now - info->age)
 		return FALSE;
 
+	lru_unlink(info->cache, cache_data);
+	info->cache->stats.size -= cache_data->size;
+
 	if (cache_data->data)
 		g_object_unref(cache_data->data);
 
@@ -335,6 +496,206 @@ static gboolean purge_hash_entry(gpointer key, gpointer data,
 	return TRUE;
 }
 
+/* Remove 'data' from whichever list it's on */
+static void lru_unlink(GFSCache *cache, GFSCacheData *data)
+{
+	if (data->lru_prev)
+		data->lru_prev->lru_next = data->lru_next;
+	else if (data->kept)
+		cache->kept = data->lru_next;
+	else
+		cache->lru_head = data->lru_next;
+
+	if (data->lru_next)
+		data->lru_next->lru_prev = data->lru_prev;
+	else if (!data->kept)
+		cache->lru_tail = data->lru_prev;
+
+	data->lru_prev = data->lru_next = NULL;
+	data->kept = FALSE;
+}
+
+/* Make 'data' the most recently used entry */
+static void lru_push(GFSCache *cache, GFSCacheData *data)
+{
+	data->lru_prev = NULL;
+	data->lru_next = cache->lru_head;
+
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = data;
+	else
+		cache->lru_tail = data;
+
+	cache->lru_head = data;
+}
+
+/* Update data->size and the cache's total (if it has a budget) */
+static void measure(GFSCache *cache, GFSCacheData *data)
+{
+	gsize	size = 0;
+
+	if (!cache->size)
+		return;
+
+	if (data->data)
+		size = cache->size(data->data, cache->user_data);
+
+	cache->stats.size += size - data->size;
+	data->size = size;
+}
+
+/* Remove an entry from the cache completely */
+static void free_entry(GFSCache *cache, GFSCacheData *data)
+{
+	g_hash_table_remove(cache->inode_to_stats, data->key);
+	lru_unlink(cache, data);
+	cache->stats.size -= data->size;
+
+	if (data->data)
+		g_object_unref(data->data);
+
+	g_free(data->key);
+	g_free(data);
+}
+
+/* Drop least recently used entries until we're within budget. 'keep'
+ * (which the caller is about to return) is moved to the front instead.
+ * Entries which are in use elsewhere, or which have no object (dropping
+ * them wouldn't save anything), are set aside so that later calls don't
+ * have to look at them again.
+ */
+static void keep_to_budget(GFSCache *cache, GFSCacheData *keep)
+{
+	if (!cache->size)
+		return;
+
+	while (cache->stats.size > cache->stats.budget && cache->lru_tail)
+	{
+		GFSCacheData *data = cache->lru_tail;
+
+		if (data == keep)
+		{
+			if (data == cache->lru_head)
+				break;		/* Nothing else to drop */
+			lru_unlink(cache, data);
+			lru_push(cache, data);
+		}
+		else if (!data->data || data->data->ref_count > 1)
+			set_aside(cache, data);
+		else
+		{
+			free_entry(cache, data);
+			cache->stats.evictions++;
+		}
+	}
+}
+
+/* Move 'data' from the LRU list to cache->kept */
+static void set_aside(GFSCache *cache, GFSCacheData *data)
+{
+	lru_unlink(cache, data);
+
+	data->lru_next = cache->kept;
+	if (cache->kept)
+		cache->kept->lru_prev = data;
+	cache->kept = data;
+	data->kept = TRUE;
+}
+
+/* Put entries which could now be dropped back on the LRU list (as the
+ * least recently used, since they haven't been looked up since they were
+ * set aside), and drop them if we're over budget.
+ */
+static void release_kept(GFSCache *cache)
+{
+	GFSCacheData *data, *next;
+
+	for (data = cache->kept; data; data = next)
+	{
+		next = data->lru_next;
+
+		if (!data->data || data->data->ref_count > 1)
+			continue;
+
+		lru_unlink(cache, data);
+		data->lru_prev = cache->lru_tail;
+		if (cache->lru_tail)
+			cache->lru_tail->lru_next = data;
+		else
+			cache->lru_head = data;
+		cache->lru_tail = data;
+	}
+
+	keep_to_budget(cache, NULL);
+}
+
+static void forget_path(gpointer data, gpointer user_data)
+{
+	GFSCache *cache = (GFSCache *) data;
+
+	g_hash_table_remove(cache->trusted_paths, user_data);
+}
+
+static void forget_all_paths(gpointer data, gpointer user_data)
+{
+	GFSCache *cache = (GFSCache *) data;
+
+	g_hash_table_remove_all(cache->trusted_paths);
+}
+
+/* If 'pathname' is trusted and still cached, return its entry without
+ * checking the file. NULL otherwise.
+ */
+static GFSCacheData *lookup_trusted(GFSCache *cache, const char *pathname)
+{
+	GFSCachePath	*path;
+	GFSCacheData	*data;
+
+	if (!cache->trusted_paths)
+		return NULL;
+
+	path = g_hash_table_lookup(cache->trusted_paths, pathname);
+	if (!path)
+		return NULL;
+
+	data = g_hash_table_lookup(cache->inode_to_stats, &path->key);
+	if (!data)
+		g_hash_table_remove(cache->trusted_paths, pathname);
+
+	return data;
+}
+
+/* We've just checked that 'pathname' is the file 'key'. If its directory
+ * is watched, remember that so we don't have to check again.
+ * Symlinks are never trusted; the watcher only sees changes to the link,
+ * not to the file it points to.
+ */
+static void trust_path(GFSCache *cache, const char *pathname,
+		       const GFSCacheKey *key)
+{
+	GFSCachePath	*path;
+	gchar		*dir;
+	gboolean	watched;
+	struct stat	info;
+
+	if (!cache->trusted_paths || !is_watched)
+		return;
+
+	dir = g_path_get_dirname(pathname);
+	watched = is_watched(dir);
+	g_free(dir);
+
+	if (!watched)
+		return;
+
+	if (mc_lstat((char *) pathname, &info) || S_ISLNK(info.st_mode))
+		return;
+
+	path = g_new(GFSCachePath, 1);
+	path->key = *key;
+	g_hash_table_replace(cache->trusted_paths, g_strdup(pathname), path);
+}
+
 /* As for g_fscache_lookup_full, but return the GFSCacheData rather than
  * the data it contains. Doesn't increment the refcount.
  */
@@ -348,6 +709,19 @@ static GFSCacheData *lookup_internal(GFSCache *cache, const char *pathname,
 	g_return_val_if_fail(cache != NULL, NULL);
 	g_return_val_if_fail(pathname != NULL, NULL);
 
+	/* INIT records the file's details, so it always needs a stat */
+	if (lookup_type != FSCACHE_LOOKUP_INIT)
+	{
+		data = lookup_trusted(cache, pathname);
+		if (data)
+		{
+			if (lookup_type != FSCACHE_LOOKUP_PEEK &&
+			    lookup_type != FSCACHE_LOOKUP_INSERT)
+				cache->stats.hits++;
+			goto out;
+		}
+	}
+
 	if (mc_stat(pathname, &info))
 		return NULL;
 
@@ -370,11 +744,16 @@ static GFSCacheData *lookup_internal(GFSCache *cache, const char *pathname,
 		/* Is it up-to-date? */
 
 		if (UPTODATE(data, info))
-			goto out;
+		{
+			cache->stats.hits++;
+			goto checked;
+		}
 		
 		if (lookup_type == FSCACHE_LOOKUP_ONLY_NEW)
 			return NULL;
 
+		cache->stats.misses++;
+
 		/* Out-of-date */
 		if (cache->update)
 			cache->update(data->data, pathname, cache->user_data);
@@ -397,8 +776,15 @@ static GFSCacheData *lookup_internal(GFSCache *cache, const char *pathname,
 
 		data = g_new(GFSCacheData, 1);
 		data->data = NULL;
+		data->key = new_key;
+		data->size = 0;
+		data->kept = FALSE;
+		lru_push(cache, data);
 
 		g_hash_table_insert(cache->inode_to_stats, new_key, data);
+
+		if (lookup_type == FSCACHE_LOOKUP_CREATE)
+			cache->stats.misses++;
 	}
 
 init:
@@ -415,9 +801,17 @@ init:
 		if (cache->load)
 			data->data = cache->load(pathname, cache->user_data);
 	}
+checked:
+	trust_path(cache, pathname, &key);
 out:
 	data->last_lookup = time(NULL);
 
+	lru_unlink(cache, data);
+	lru_push(cache, data);
+
+	measure(cache, data);
+	keep_to_budget(cache, data);
+
 	return data;
 }
 
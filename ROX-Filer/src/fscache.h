@@ -18,6 +18,8 @@ typedef GObject *(*GFSLoadFunc)(const char *pathname, gpointer user_data);
 typedef void (*GFSUpdateFunc)(gpointer object,
 			      const char *pathname,
 			      gpointer user_data);
+typedef gsize (*GFSSizeFunc)(gpointer object, gpointer user_data);
+typedef gboolean (*GFSWatchedFunc)(const char *dir);
 typedef enum {
 	FSCACHE_LOOKUP_CREATE,	/* Load if missing. Update as needed. */
 	FSCACHE_LOOKUP_ONLY_NEW,/* Return NULL if not present AND uptodate */
@@ -26,6 +28,17 @@ typedef enum {
 	FSCACHE_LOOKUP_INSERT,	/* Internal use */
 } FSCacheLookup;
 
+typedef struct _GFSCacheStats GFSCacheStats;
+
+struct _GFSCacheStats {
+	guint	entries;	/* Number of files cached */
+	gsize	size;		/* Total size of the objects, in bytes */
+	gsize	budget;		/* Limit on 'size', or 0 */
+	gulong	hits;		/* Lookups answered from the cache */
+	gulong	misses;		/* Lookups which had to (re)load */
+	gulong	evictions;	/* Entries dropped to keep within budget */
+};
+
 GFSCache *g_fscache_new(GFSLoadFunc load,
 			GFSUpdateFunc update,
 			gpointer user_data);
@@ -37,6 +50,12 @@ gpointer g_fscache_lookup_full(GFSCache *cache, const char *pathname,
 void g_fscache_may_update(GFSCache *cache, const char *pathname);
 void g_fscache_update(GFSCache *cache, const char *pathname);
 void g_fscache_purge(GFSCache *cache, gint age);
+void g_fscache_set_budget(GFSCache *cache, gsize budget, GFSSizeFunc size);
+void g_fscache_get_stats(GFSCache *cache, GFSCacheStats *stats);
+void g_fscache_trust_watched(GFSCache *cache);
+void g_fscache_set_watched_func(GFSWatchedFunc watched);
+void g_fscache_path_changed(const char *pathname);
+void g_fscache_distrust_all(void);
 
 void g_fscache_insert(GFSCache *cache, const char *pathname, gpointer obj,
 		      gboolean update_details);
@@ -46,6 +46,7 @@
 #include "pixmaps.h"
 #include "xtypes.h"
 #include "filer.h"
+#include "dir.h"
 
 typedef struct _FileStatus FileStatus;
 
@@ -78,6 +79,7 @@ struct _Permissions
 /* Static prototypes */
 static void refresh_info(GObject *window);
 static GtkWidget *make_vbox(const guchar *path, GObject *window);
+static void add_listing_row(GtkListStore *store, const guchar *path);
 static GtkWidget *make_details(const guchar *path, DirItem *item,
 				GObject *window);
 static GtkWidget *make_about(const guchar *path, XMLwrapper *ai);
@@ -551,6 +553,37 @@ static void cell_edited(GtkCellRendererText *cell,
 	g_idle_add(refresh_info_idle, window);
 }
 
+/* If the directory is open, show how much memory its listing uses, and
+ * whether changes to it are being polled for.
+ */
+static void add_listing_row(GtkListStore *store, const guchar *path)
+{
+	gchar	*real_path;
+	guint	n_items;
+	gsize	bytes;
+
+	real_path = pathdup(path);
+	if (dir_memory_usage(real_path, &n_items, &bytes) && n_items)
+	{
+		add_row_and_free(store, _("Listing:"),
+			g_strdup_printf(_("%u items, %u bytes each"), n_items,
+					(guint) (bytes / n_items)));
+	}
+	if (dir_is_polled(real_path))
+	{
+		GList	*polled;
+		guint	used, budget;
+
+		polled = dir_watch_usage(&used, &budget);
+		add_row_and_free(store, _("Updates:"),
+			g_strdup_printf(_("Polled, with %u others "
+					  "(all %u watches are in use)"),
+					g_list_length(polled) - 1, used));
+		destroy_glist(&polled);
+	}
+	g_free(real_path);
+}
+
 /* Create the TreeView widget with the file's details */
 static GtkWidget *make_details(const guchar *path, DirItem *item,
 				GObject *window)
@@ -577,8 +610,8 @@ static GtkWidget *make_details(const guchar *path, DirItem *item,
 
 	add_row_and_free(store, _("Owner, Group:"),
 			 g_strdup_printf("%s, %s",
-					 user_name(item->uid),
-					 group_name(item->gid)));
+					 user_name_now(item->uid),
+					 group_name_now(item->gid)));
 
 	if (item->base_type != TYPE_DIRECTORY)
 	{
@@ -637,6 +670,8 @@ static GtkWidget *make_details(const guchar *path, DirItem *item,
 				g_free(du);
 			}
 		}
+
+		add_listing_row(store, path);
 	}
 
 	add_row_and_free(store, _("Change time:"), pretty_time(&item->ctime));
@@ -278,6 +278,10 @@ int main(int argc, char **argv)
 		close(fd);
 	}
 
+	/* Directory items are restatted by worker threads (see dir.c) */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
 	home_dir = g_get_home_dir();
 	home_dir_len = strlen(home_dir);
 	app_dir = g_strdup(getenv("APP_DIR"));
@@ -528,7 +532,7 @@ int main(int argc, char **argv)
 
 	if (euid == 0 || show_user)
 		show_user_message = g_strdup_printf(_("Running as user '%s'"), 
-						    user_name(euid));
+						    user_name_now(euid));
 	
 	/* Add each remaining (non-option) argument to the list of files
 	 * to run.
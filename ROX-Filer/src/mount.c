@@ -25,6 +25,7 @@
 #include <errno.h>
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
+#include <pthread.h>
 #endif
 #ifdef HAVE_MNTENT_H
   /* Linux, etc */
@@ -56,11 +57,18 @@
 
 #include "mount.h"
 #include "support.h"
+#include "dir.h"
+#include "options.h"
 
 /* Map mount points to mntent structures */
 GHashTable *fstab_mounts = NULL;
 time_t fstab_time;
 
+/* fstab_mounts is only changed in the main thread, which may read it freely.
+ * Other threads must hold this lock and use mount_is_in_fstab().
+ */
+G_LOCK_DEFINE_STATIC(fstab_mounts);
+
 /* Keys are mount points that the user mounted. Values are ignored. */
 static GHashTable *user_mounts = NULL;
 
@@ -70,6 +78,41 @@ static GHashTable *user_mounts = NULL;
 #define THE_FSTAB "/etc/fstab"
 #endif
 
+/* Linux lists the live mounts here, and flags it with POLLPRI when they
+ * change.
+ */
+#define MOUNTINFO "/proc/self/mountinfo"
+
+/* Paths currently mounted on, as read from MOUNTINFO (values are the
+ * keys), or NULL if it can't be read. Only replaced in the main thread,
+ * which may read it freely. Other threads must hold this lock.
+ */
+static GHashTable *live_mounts = NULL;
+G_LOCK_DEFINE_STATIC(live_mounts);
+
+/* A mount point is slow if restatting it takes longer than this (in
+ * seconds) on average, or if one restat has already taken longer.
+ */
+#define SLOW_MOUNT_LATENCY 0.5
+
+typedef struct _MountLatency MountLatency;
+
+struct _MountLatency
+{
+	gdouble	average;	/* Seconds per restat, recent ones weighted */
+	gint	in_flight;	/* Restats started but not yet finished */
+	gdouble	started;	/* When the oldest of those began */
+};
+
+/* Mount point -> MountLatency, for each one we have restatted. Used from
+ * any thread, with the lock held.
+ */
+static GHashTable *latencies = NULL;
+G_LOCK_DEFINE_STATIC(latencies);
+
+/* Restat mount points on slow filesystems in the background? */
+Option o_mount_async;
+
 /* Static prototypes */
 #ifdef DO_MOUNT_POINTS
 static void read_table(void);
@@ -77,6 +120,15 @@ static void clear_table(void);
 static time_t read_time(char *path);
 static gboolean free_mp(gpointer key, gpointer value, gpointer data);
 #endif
+static GHashTable *read_mountinfo(void);
+static void refresh_live_mounts(void);
+static void check_if_missing(gpointer key, gpointer value, gpointer data);
+static gboolean mountinfo_changed(GIOChannel *source,
+				  GIOCondition condition, gpointer data);
+static gboolean forget_latency(gpointer key, gpointer value, gpointer data);
+static gdouble now(void);
+static void lock_for_fork(void);
+static void unlock_after_fork(void);
 
 
 /****************************************************************
@@ -88,6 +140,16 @@ void mount_init(void)
 	fstab_mounts = g_hash_table_new(g_str_hash, g_str_equal);
 	user_mounts = g_hash_table_new_full(g_str_hash, g_str_equal,
 					    g_free, NULL);
+	latencies = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, g_free);
+
+	option_add_int(&o_mount_async, "mount_async", TRUE);
+
+	/* Worker threads use these tables, and action windows fork()
+	 * without exec(). Don't fork while a thread holds a lock, or the
+	 * child would wait for it forever.
+	 */
+	pthread_atfork(lock_for_fork, unlock_after_fork, unlock_after_fork);
 
 #ifdef DO_MOUNT_POINTS
 	if(file_exists(THE_FSTAB))
@@ -103,8 +165,28 @@ void mount_init(void)
 		g_warning(_("File system table \"%s\" not found, cannot monitor system mounts"), THE_FSTAB);
 #endif
 	}
+	G_LOCK(fstab_mounts);
 	read_table();
+	G_UNLOCK(fstab_mounts);
 #endif
+
+	live_mounts = read_mountinfo();
+	if (live_mounts)
+	{
+		GIOChannel	*channel;
+		int		fd;
+
+		/* (only polled, never read) */
+		fd = open(MOUNTINFO, O_RDONLY);
+		if (fd != -1)
+		{
+			close_on_exec(fd, TRUE);
+			channel = g_io_channel_unix_new(fd);
+			g_io_add_watch(channel, G_IO_PRI, mountinfo_changed,
+					NULL);
+			g_io_channel_unref(channel);
+		}
+	}
 }
 
 /* If force is true then ignore the timestamps */
@@ -117,9 +199,17 @@ void mount_update(gboolean force)
 	if (force || time != fstab_time)
 	{
 		fstab_time = time;
+		G_LOCK(fstab_mounts);
 		read_table();
+		G_UNLOCK(fstab_mounts);
 	}
 #endif /* DO_MOUNT_POINTS */
+
+	/* (normally mountinfo_changed() does this, but the caller may
+	 * need the result before we get back to the main loop)
+	 */
+	if (force)
+		refresh_live_mounts();
 }
 
 /* The user has just finished mounting/unmounting this path.
@@ -133,19 +223,37 @@ void mount_user_mount(const char *path)
 		g_hash_table_remove(user_mounts, path);
 }
 
-/* TRUE iff this directory is a mount point. Uses python's method to
+/* TRUE iff this directory is a mount point. Where the kernel lists the
+ * live mounts, this is just a lookup in our copy of the list. That only
+ * finds real paths, so unless the caller passes 'info' (as when scanning
+ * a directory, whose path is always real) we also use python's method to
  * check:
  * The function checks whether path's parent, path/.., is on a different device
  * than path, or whether path/.. and path point to the same i-node on the same
  * device -- this should detect mount points for all Unix and POSIX variants.
  *
  * 'info' and 'parent' are both optional, saving one stat() each.
+ * May be called from any thread.
  */
 gboolean mount_is_mounted(const guchar *path, struct stat *info,
 					      struct stat *parent)
 {
 	struct stat info_path, info_parent;
 
+	G_LOCK(live_mounts);
+	if (live_mounts)
+	{
+		gboolean listed;
+
+		listed = g_hash_table_lookup(live_mounts, path) != NULL;
+		G_UNLOCK(live_mounts);
+
+		if (listed || info)
+			return listed;
+	}
+	else
+		G_UNLOCK(live_mounts);
+
 	if (!info)
 	{
 		info = &info_path;
@@ -175,6 +283,20 @@ gboolean mount_is_mounted(const guchar *path, struct stat *info,
 	return FALSE;
 }
 
+/* TRUE if 'path' is listed in the fstab. Unlike looking in fstab_mounts
+ * directly, this may be called from any thread.
+ */
+gboolean mount_is_in_fstab(const gchar *path)
+{
+	gboolean retval;
+
+	G_LOCK(fstab_mounts);
+	retval = g_hash_table_lookup(fstab_mounts, path) != NULL;
+	G_UNLOCK(fstab_mounts);
+
+	return retval;
+}
+
 /* TRUE if this mount point was mounted by the user, and still is */
 gboolean mount_is_user_mounted(const gchar *path)
 {
@@ -197,10 +319,209 @@ gboolean mount_is_user_mounted(const gchar *path)
 	return retval;
 }
 
+/* TRUE if something is mounted on 'path', which must be a real path. Unlike
+ * mount_is_mounted(), this never makes any system calls (and so can't hang
+ * on a dead mount). Always FALSE if the live mounts aren't known.
+ * May be called from any thread.
+ */
+gboolean mount_is_live(const gchar *path)
+{
+	gboolean retval;
+
+	G_LOCK(live_mounts);
+	retval = live_mounts && g_hash_table_lookup(live_mounts, path);
+	G_UNLOCK(live_mounts);
+
+	return retval;
+}
+
+/* Call this just before restatting the mount point 'path'. Pass the result
+ * to mount_stat_end() when the restat has finished. Any thread.
+ */
+gdouble mount_stat_begin(const gchar *path)
+{
+	MountLatency *latency;
+	gdouble	start;
+
+	start = now();
+
+	G_LOCK(latencies);
+	latency = g_hash_table_lookup(latencies, path);
+	if (!latency)
+	{
+		latency = g_new0(MountLatency, 1);
+		latency->average = -1;
+		g_hash_table_insert(latencies, g_strdup(path), latency);
+	}
+	if (latency->in_flight++ == 0)
+		latency->started = start;
+	G_UNLOCK(latencies);
+
+	return start;
+}
+
+/* The restat of 'path' started at 'start' has finished. Any thread. */
+void mount_stat_end(const gchar *path, gdouble start)
+{
+	MountLatency *latency;
+	gdouble	taken;
+
+	taken = now() - start;
+
+	G_LOCK(latencies);
+	latency = g_hash_table_lookup(latencies, path);
+	if (latency)
+	{
+		latency->in_flight--;
+		if (latency->average < 0)
+			latency->average = taken;
+		else
+			latency->average = latency->average * 0.75 +
+					   taken * 0.25;
+	}
+	G_UNLOCK(latencies);
+}
+
+/* TRUE if a restat of the mount point 'path' is still in progress */
+gboolean mount_stat_pending(const gchar *path)
+{
+	MountLatency *latency;
+	gboolean retval;
+
+	G_LOCK(latencies);
+	latency = g_hash_table_lookup(latencies, path);
+	retval = latency && latency->in_flight;
+	G_UNLOCK(latencies);
+
+	return retval;
+}
+
+/* TRUE if the filesystem mounted on 'path' has been slow to restat, or
+ * is being slow now (see SLOW_MOUNT_LATENCY). Any thread.
+ */
+gboolean mount_is_slow(const gchar *path)
+{
+	MountLatency *latency;
+	gboolean retval = FALSE;
+
+	G_LOCK(latencies);
+	latency = g_hash_table_lookup(latencies, path);
+	if (latency)
+		retval = latency->average > SLOW_MOUNT_LATENCY ||
+			 (latency->in_flight &&
+			  now() - latency->started > SLOW_MOUNT_LATENCY);
+	G_UNLOCK(latencies);
+
+	return retval;
+}
+
 /****************************************************************
  *			INTERNAL FUNCTIONS			*
  ****************************************************************/
 
+/* The time, in seconds */
+static gdouble now(void)
+{
+	GTimeVal tv;
+
+	g_get_current_time(&tv);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Drop the history of filesystems which have been unmounted, unless a
+ * restat is still stuck on one.
+ */
+static gboolean forget_latency(gpointer key, gpointer value, gpointer data)
+{
+	MountLatency *latency = (MountLatency *) value;
+
+	return !latency->in_flight &&
+		!g_hash_table_lookup((GHashTable *) data, key);
+}
+
+/* Returns a new table of the paths in MOUNTINFO, or NULL if it can't be
+ * read. Each line is
+ * "id parent-id major:minor root mount-point options..."
+ * with spaces, etc, in paths escaped in octal.
+ */
+static GHashTable *read_mountinfo(void)
+{
+	GHashTable	*table;
+	gchar		*contents;
+	gchar		**lines;
+	int		i;
+
+	if (!g_file_get_contents(MOUNTINFO, &contents, NULL, NULL))
+		return NULL;
+
+	table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	lines = g_strsplit(contents, "\n", 0);
+	g_free(contents);
+
+	for (i = 0; lines[i]; i++)
+	{
+		gchar	**fields;
+
+		fields = g_strsplit(lines[i], " ", 6);
+		if (g_strv_length(fields) == 6)
+		{
+			gchar *dir;
+
+			dir = g_strcompress(fields[4]);
+			g_hash_table_insert(table, dir, dir);
+		}
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+
+	return table;
+}
+
+/* Reread MOUNTINFO. Any directories mounted or unmounted since last time
+ * are restatted, so that they get the right icons in filer windows.
+ */
+static void refresh_live_mounts(void)
+{
+	GHashTable	*old, *new;
+
+	new = read_mountinfo();
+	if (!new)
+		return;
+
+	G_LOCK(live_mounts);
+	old = live_mounts;
+	live_mounts = new;
+	G_UNLOCK(live_mounts);
+
+	G_LOCK(latencies);
+	g_hash_table_foreach_remove(latencies, forget_latency, new);
+	G_UNLOCK(latencies);
+
+	if (old)
+	{
+		g_hash_table_foreach(old, check_if_missing, new);
+		g_hash_table_foreach(new, check_if_missing, old);
+		g_hash_table_destroy(old);
+	}
+}
+
+/* If 'key' isn't in the table 'data', its mount status has changed */
+static void check_if_missing(gpointer key, gpointer value, gpointer data)
+{
+	if (!g_hash_table_lookup((GHashTable *) data, key))
+		dir_check_this((guchar *) key);
+}
+
+static gboolean mountinfo_changed(GIOChannel *source,
+				  GIOCondition condition, gpointer data)
+{
+	refresh_live_mounts();
+
+	return TRUE;
+}
+
 
 #ifdef DO_MOUNT_POINTS
 
@@ -399,3 +720,17 @@ gchar *mount_get_fs_size(const gchar *dir)
     return str;
 }
 
+/* pthread_atfork() handlers; see mount_init() */
+static void lock_for_fork(void)
+{
+	G_LOCK(fstab_mounts);
+	G_LOCK(live_mounts);
+	G_LOCK(latencies);
+}
+
+static void unlock_after_fork(void)
+{
+	G_UNLOCK(latencies);
+	G_UNLOCK(live_mounts);
+	G_UNLOCK(fstab_mounts);
+}
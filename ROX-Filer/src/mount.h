@@ -12,6 +12,7 @@
 #  endif
 
 extern GHashTable *fstab_mounts;
+extern Option o_mount_async;
 
 typedef struct _MountPoint MountPoint;
 
@@ -28,6 +29,12 @@ void mount_user_mount(const char *path);
 gboolean mount_is_user_mounted(const gchar *path);
 gboolean mount_is_mounted(const guchar *path, struct stat *info,
 					      struct stat *parent);
+gboolean mount_is_in_fstab(const gchar *path);
 gchar *mount_get_fs_size(const gchar *dir);
+gboolean mount_is_live(const gchar *path);
+gdouble mount_stat_begin(const gchar *path);
+void mount_stat_end(const gchar *path, gdouble start);
+gboolean mount_stat_pending(const gchar *path);
+gboolean mount_is_slow(const gchar *path);
 
 #endif /* _MOUNT_H */
@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
@@ -78,6 +79,7 @@ static const char * bad_xpm[] = {
 
 MaskedPixmap *im_error;
 MaskedPixmap *im_unknown;
+MaskedPixmap *im_mount_pending;
 
 MaskedPixmap *im_appdir;
 
@@ -85,15 +87,59 @@ MaskedPixmap *im_dirs;
 
 GtkIconSize mount_icon_size = -1;
 
-typedef struct _ChildThumbnail ChildThumbnail;
+/* Max thumbnails to create at once. 0 => one per online CPU */
+static Option o_thumb_jobs;
 
-/* There is one of these for each active child process */
-struct _ChildThumbnail {
-	gchar	 *path;
+/* Megabytes of unused images to keep in pixmap_cache. 0 => no limit */
+static Option o_pixmap_cache_size;
+
+typedef struct _ThumbWaiter ThumbWaiter;
+typedef struct _ThumbJob ThumbJob;
+
+/* Someone who wants to know when a thumbnail is ready */
+struct _ThumbWaiter {
 	GFunc	 callback;
 	gpointer data;
+	int	 priority;
+};
+
+/* There is one of these for each thumbnail queued or being created.
+ * It is shared by everyone who asked for that path.
+ */
+struct _ThumbJob {
+	gchar	 *path;
+	int	 priority;	/* Lowest of the waiters' priorities */
+	guint	 serial;	/* Order of arrival, for equal priorities */
+	gboolean running;	/* FALSE => still on thumb_queue */
+	GList	 *waiters;	/* ThumbWaiters */
+
+	/* For thumbnails created by thumb_worker() */
+	MIME_type *type;
+	GdkPixbuf *thumb;	/* NULL => failed */
 };
 
+static GHashTable *thumb_jobs = NULL;	/* Path -> ThumbJob */
+static GList *thumb_queue = NULL;	/* ThumbJobs not yet started */
+static gboolean thumb_queue_sorted = TRUE;
+static guint thumb_serial = 0;
+static int thumbs_running = 0;
+static gint thumb_idle = 0;		/* start_thumbs() idle callback */
+
+/* Images we can load ourselves are thumbnailed by these threads, rather
+ * than by forking. NULL if threads aren't available.
+ */
+static GThreadPool *thumb_pool = NULL;
+
+/* Jobs finished by thumb_worker(), for thumbs_made() to pick up */
+G_LOCK_DEFINE_STATIC(thumbs_done);
+static GList *thumbs_done = NULL;
+static gint thumbs_done_idle = 0;
+
+/* Most thumbnails start_thumbs() will handle in one go, when they
+ * turn out to be already up-to-date and don't need a child process.
+ */
+#define THUMB_START_BATCH 8
+
 static const char *stocks[] = {
 	ROX_STOCK_SHOW_DETAILS,
 	ROX_STOCK_SHOW_HIDDEN,
@@ -113,12 +159,24 @@ static MaskedPixmap *image_from_desktop_file(const char *path);
 static MaskedPixmap *get_bad_image(void);
 static GdkPixbuf *scale_pixbuf_up(GdkPixbuf *src, int max_w, int max_h);
 static GdkPixbuf *get_thumbnail_for(const char *path);
-static void thumbnail_child_done(ChildThumbnail *info);
-static void child_create_thumbnail(const gchar *path, MIME_type *type);
+static void thumbnail_child_done(ThumbJob *job);
+static void thumb_worker(gpointer data, gpointer user_data);
+static gboolean thumbs_made(gpointer data);
+static void thumb_loaded(ThumbJob *job, GdkPixbuf *thumb);
+static gboolean start_thumbs(gpointer data);
+static gboolean start_thumb(ThumbJob *job);
+static void thumb_job_done(ThumbJob *job, gboolean success);
+static void update_job_priority(ThumbJob *job);
+static gint thumb_job_cmp(gconstpointer a, gconstpointer b);
+static int thumb_max_jobs(void);
+static GdkPixbuf *create_thumbnail(const gchar *path, MIME_type *type);
 static GList *thumbs_purge_cache(Option *option, xmlNode *node, guchar *label);
 static gchar *thumbnail_path(const gchar *path);
 static gchar *thumbnail_program(MIME_type *type);
 static GdkPixbuf *extract_tiff_thumbnail(const gchar *path);
+static gsize pixbuf_size(GdkPixbuf *pixbuf, GdkPixbuf **counted, int n);
+static gsize masked_pixmap_size(MaskedPixmap *mp, gpointer data);
+static void pixmaps_options_changed(void);
 
 /****************************************************************
  *			EXTERNAL INTERFACE			*
@@ -132,6 +190,11 @@ void pixmaps_init(void)
 	gtk_widget_push_colormap(gdk_rgb_get_colormap());
 
 	pixmap_cache = g_fscache_new((GFSLoadFunc) image_from_file, NULL, NULL);
+	g_fscache_trust_watched(pixmap_cache);
+	thumb_jobs = g_hash_table_new(g_str_hash, g_str_equal);
+	if (g_thread_supported())
+		thumb_pool = g_thread_pool_new(thumb_worker, NULL,
+					       -1, FALSE, NULL);
 	desktop_icon_cache = g_fscache_new((GFSLoadFunc) image_from_desktop_file, NULL, NULL);
 
 	g_timeout_add(10000, purge, NULL);
@@ -167,6 +230,12 @@ void pixmaps_init(void)
 	load_default_pixmaps();
 
 	option_register_widget("thumbs-purge-cache", thumbs_purge_cache);
+	option_add_int(&o_thumb_jobs, "thumb_jobs", 0);
+	option_add_int(&o_pixmap_cache_size, "pixmap_cache_size", 64);
+	option_add_notify(pixmaps_options_changed);
+	g_fscache_set_budget(pixmap_cache,
+			     (gsize) o_pixmap_cache_size.int_value << 20,
+			     (GFSSizeFunc) masked_pixmap_size);
 }
 
 /* Load image <appdir>/images/name.png.
@@ -257,106 +326,105 @@ void pixmap_make_small(MaskedPixmap *mp)
 	mp->sm_height = gdk_pixbuf_get_height(mp->sm_pixbuf);
 }
 
-/* Load image 'path' in the background and insert into pixmap_cache.
- * Call callback(data, path) when done (path is NULL => error).
- * If the image is already uptodate, or being created already, calls the
- * callback right away.
+/* Queue 'path' to be thumbnailed in the background. Up to o_thumb_jobs
+ * thumbnails are created at once, lowest priority first. When done, the
+ * image is inserted into pixmap_cache and callback(data, path) is called
+ * (path is NULL => error). The callback is never called before this
+ * function returns, even if the thumbnail is already up-to-date.
+ * Returns FALSE if this callback and data are already waiting for path,
+ * in which case only the priority is updated.
  */
-void pixmap_background_thumb(const gchar *path, GFunc callback, gpointer data)
+gboolean pixmap_background_thumb(const gchar *path, int priority,
+				 GFunc callback, gpointer data)
 {
-	gboolean	found;
-	MaskedPixmap	*image;
-	pid_t		child;
-	ChildThumbnail	*info;
-	MIME_type       *type;
-	gchar		*thumb_prog;
-
-	image = pixmap_try_thumb(path, TRUE);
+	ThumbJob	*job;
+	ThumbWaiter	*waiter;
+	GList		*next;
 
-	if (image)
+	job = g_hash_table_lookup(thumb_jobs, path);
+	if (job)
 	{
-		/* Thumbnail loaded */
-		callback(data, (gpointer)path);
-		return;
+		for (next = job->waiters; next; next = next->next)
+		{
+			waiter = (ThumbWaiter *) next->data;
+			if (waiter->callback == callback && waiter->data == data)
+			{
+				waiter->priority = priority;
+				update_job_priority(job);
+				return FALSE;
+			}
+		}
 	}
-
-	/* Is it currently being created? */
-	image = g_fscache_lookup_full(pixmap_cache, path,
-					FSCACHE_LOOKUP_ONLY_NEW, &found);
-
-	if (found)
+	else
 	{
-		/* Thumbnail is known, or being created */
-		if (image)
-			g_object_unref(image);
-		callback(data, image? (gpointer)path: NULL);
-		return;
+		job = g_new(ThumbJob, 1);
+		job->path = g_strdup(path);
+		job->priority = G_MAXINT;
+		job->serial = thumb_serial++;
+		job->running = FALSE;
+		job->waiters = NULL;
+		job->type = NULL;
+		job->thumb = NULL;
+
+		g_hash_table_insert(thumb_jobs, job->path, job);
+		thumb_queue = g_list_prepend(thumb_queue, job);
+		thumb_queue_sorted = FALSE;
 	}
 
-	/* Not in memory, nor in the thumbnails directory.  We need to
-	 * generate it */
+	waiter = g_new(ThumbWaiter, 1);
+	waiter->callback = callback;
+	waiter->data = data;
+	waiter->priority = priority;
+	job->waiters = g_list_prepend(job->waiters, waiter);
+	update_job_priority(job);
 
-	type = type_from_path(path);
-	if (!type)
-		type = text_plain;
+	if (!thumb_idle)
+		thumb_idle = g_idle_add(start_thumbs, NULL);
 
-	/* Add an entry, set to NULL, so no-one else tries to load this
-	 * image.
-	 */
-	g_fscache_insert(pixmap_cache, path, NULL, TRUE);
+	return TRUE;
+}
 
-	thumb_prog = thumbnail_program(type);
+static void find_waiting(gpointer key, gpointer value, gpointer data)
+{
+	ThumbJob *job = (ThumbJob *) value;
+	GList	 *next = job->waiters;
 
-	/* Only attempt to load 'images' types ourselves */
-	if (thumb_prog == NULL && strcmp(type->media_type, "image") != 0)
+	while (next)
 	{
-		callback(data, NULL);
-		return;		/* Don't know how to handle this type */
-	}
-
-	child = fork();
+		ThumbWaiter *waiter = (ThumbWaiter *) next->data;
 
-	if (child == -1)
-	{
-		g_free(thumb_prog);
-		delayed_error("fork(): %s", g_strerror(errno));
-		callback(data, NULL);
-		return;
+		next = next->next;
+		if (waiter->data != data)
+			continue;
+		job->waiters = g_list_remove(job->waiters, waiter);
+		g_free(waiter);
 	}
 
-	if (child == 0)
-	{
-		/* We are the child process.  (We are sloppy with freeing
-		 memory, but since we go away very quickly, that's ok.) */
-		if (thumb_prog)
-		{
-			DirItem *item;
-			
-			item = diritem_new(g_basename(thumb_prog));
+	if (job->waiters)
+		update_job_priority(job);
+}
 
-			diritem_restat(thumb_prog, item, NULL);
-			if (item->flags & ITEM_FLAG_APPDIR)
-				thumb_prog = g_strconcat(thumb_prog, "/AppRun",
-						       NULL);
+static gboolean drop_unwanted(gpointer key, gpointer value, gpointer data)
+{
+	ThumbJob *job = (ThumbJob *) value;
 
-			execl(thumb_prog, thumb_prog, path,
-			      thumbnail_path(path),
-			      g_strdup_printf("%d", PIXMAP_THUMB_SIZE),
-			      NULL);
-			_exit(1);
-		}
+	if (job->waiters || job->running)
+		return FALSE;
 
-		child_create_thumbnail(path, type);
-		_exit(0);
-	}
+	thumb_queue = g_list_remove(thumb_queue, job);
+	g_free(job->path);
+	g_free(job);
 
-	g_free(thumb_prog);
+	return TRUE;
+}
 
-	info = g_new(ChildThumbnail, 1);
-	info->path = g_strdup(path);
-	info->callback = callback;
-	info->data = data;
-	on_child_death(child, (CallbackFn) thumbnail_child_done, info);
+/* Forget all requests from pixmap_background_thumb() with this callback
+ * data. Queued thumbnails which no-one else wants are not created.
+ */
+void pixmap_cancel_thumbs(gpointer data)
+{
+	g_hash_table_foreach(thumb_jobs, find_waiting, data);
+	g_hash_table_foreach_remove(thumb_jobs, drop_unwanted, NULL);
 }
 
 /*
@@ -441,25 +509,24 @@ MaskedPixmap *pixmap_try_thumb(const gchar *path, gboolean can_load)
  ****************************************************************/
 
 /* Create a thumbnail file for this image */
-static void save_thumbnail(const char *pathname, GdkPixbuf *full)
+static GdkPixbuf *save_thumbnail(const char *pathname, GdkPixbuf *full)
 {
 	struct stat info;
 	gchar *path;
 	int original_width, original_height;
 	GString *to;
 	char *md5, *swidth, *sheight, *ssize, *smtime, *uri;
-	mode_t old_mask;
 	int name_len;
 	GdkPixbuf *thumb;
 
+	if (mc_stat(pathname, &info) != 0)
+		return NULL;
+
 	thumb = scale_pixbuf(full, PIXMAP_THUMB_SIZE, PIXMAP_THUMB_SIZE);
 
 	original_width = gdk_pixbuf_get_width(full);
 	original_height = gdk_pixbuf_get_height(full);
 
-	if (mc_stat(pathname, &info) != 0)
-		return;
-
 	swidth = g_strdup_printf("%d", original_width);
 	sheight = g_strdup_printf("%d", original_height);
 	ssize = g_strdup_printf("%" SIZE_FMT, info.st_size);
@@ -483,7 +550,6 @@ static void save_thumbnail(const char *pathname, GdkPixbuf *full)
 
 	g_free(md5);
 
-	old_mask = umask(0077);
 	gdk_pixbuf_save(thumb, to->str, "png", NULL,
 			"tEXt::Thumb::Image::Width", swidth,
 			"tEXt::Thumb::Image::Height", sheight,
@@ -492,7 +558,8 @@ static void save_thumbnail(const char *pathname, GdkPixbuf *full)
 			"tEXt::Thumb::URI", uri,
 			"tEXt::Software", PROJECT,
 			NULL);
-	umask(old_mask);
+	/* (not umask, which would affect every thread) */
+	chmod(to->str, 0600);
 
 	/* We create the file ###.png.ROX-Filer-PID and rename it to avoid
 	 * a race condition if two programs create the same thumb at
@@ -514,6 +581,8 @@ static void save_thumbnail(const char *pathname, GdkPixbuf *full)
 	g_free(ssize);
 	g_free(smtime);
 	g_free(uri);
+
+	return thumb;
 }
 
 static gchar *thumbnail_path(const char *path)
@@ -570,12 +639,13 @@ static gchar *thumbnail_program(MIME_type *type)
 	return path;
 }
 
-/* Called in a subprocess. Load path and create the thumbnail
- * file. Parent will notice when we die.
+/* Called in a subprocess or worker thread. Load path and create the
+ * thumbnail file. Returns the new thumbnail, or NULL on failure.
  */
-static void child_create_thumbnail(const gchar *path, MIME_type *type)
+static GdkPixbuf *create_thumbnail(const gchar *path, MIME_type *type)
 {
 	GdkPixbuf *image=NULL;
+	GdkPixbuf *thumb=NULL;
 
         if(strcmp(type->subtype, "jpeg")==0)
             image=extract_tiff_thumbnail(path);
@@ -585,18 +655,64 @@ static void child_create_thumbnail(const gchar *path, MIME_type *type)
 			PIXMAP_THUMB_SIZE, PIXMAP_THUMB_SIZE, TRUE, NULL);
 
 	if (image)
-		save_thumbnail(path, image);
+	{
+		thumb = save_thumbnail(path, image);
+		g_object_unref(image);
+	}
 
-	/* (no need to unref, as we're about to exit) */
+	return thumb;
 }
 
 /* Called when the child process exits */
-static void thumbnail_child_done(ChildThumbnail *info)
+static void thumbnail_child_done(ThumbJob *job)
 {
-	GdkPixbuf *thumb;
+	thumb_loaded(job, get_thumbnail_for(job->path));
+}
+
+/* Called in a worker thread to create the thumbnail for job.
+ * The job is passed back to the main thread when done.
+ */
+static void thumb_worker(gpointer data, gpointer user_data)
+{
+	ThumbJob *job = (ThumbJob *) data;
 
-	thumb = get_thumbnail_for(info->path);
+	job->thumb = create_thumbnail(job->path, job->type);
+
+	G_LOCK(thumbs_done);
+	thumbs_done = g_list_prepend(thumbs_done, job);
+	if (!thumbs_done_idle)
+		thumbs_done_idle = g_idle_add(thumbs_made, NULL);
+	G_UNLOCK(thumbs_done);
+}
 
+/* Idle callback for jobs finished by thumb_worker() */
+static gboolean thumbs_made(gpointer data)
+{
+	GList	*jobs, *next;
+
+	G_LOCK(thumbs_done);
+	jobs = g_list_reverse(thumbs_done);
+	thumbs_done = NULL;
+	thumbs_done_idle = 0;
+	G_UNLOCK(thumbs_done);
+
+	for (next = jobs; next; next = next->next)
+	{
+		ThumbJob *job = (ThumbJob *) next->data;
+
+		thumb_loaded(job, job->thumb);
+	}
+
+	g_list_free(jobs);
+
+	return FALSE;
+}
+
+/* Put thumb (if not NULL) in the cache and finish job.
+ * Takes ownership of thumb.
+ */
+static void thumb_loaded(ThumbJob *job, GdkPixbuf *thumb)
+{
 	if (thumb)
 	{
 		MaskedPixmap *image;
@@ -604,16 +720,245 @@ static void thumbnail_child_done(ChildThumbnail *info)
 		image = masked_pixmap_new(thumb);
 		g_object_unref(thumb);
 
-		g_fscache_insert(pixmap_cache, info->path, image, FALSE);
+		g_fscache_insert(pixmap_cache, job->path, image, FALSE);
 		g_object_unref(image);
+	}
+
+	thumb_job_done(job, thumb != NULL);
+}
 
-		info->callback(info->data, info->path);
+/* Idle callback. Start queued thumbnails while there are free slots. */
+static gboolean start_thumbs(gpointer data)
+{
+	int	max_jobs, handled = 0;
+
+	max_jobs = thumb_max_jobs();
+
+	if (!thumb_queue_sorted)
+	{
+		thumb_queue = g_list_sort(thumb_queue, thumb_job_cmp);
+		thumb_queue_sorted = TRUE;
 	}
-	else
-		info->callback(info->data, NULL);
 
-	g_free(info->path);
-	g_free(info);
+	while (thumb_queue && thumbs_running < max_jobs &&
+	       handled < THUMB_START_BATCH)
+	{
+		ThumbJob *job = (ThumbJob *) thumb_queue->data;
+
+		thumb_queue = g_list_delete_link(thumb_queue, thumb_queue);
+
+		if (!start_thumb(job))
+			handled++;
+	}
+
+	if (thumb_queue && thumbs_running < max_jobs)
+		return TRUE;	/* More to do, but let the GUI run first */
+
+	thumb_idle = 0;
+	return FALSE;
+}
+
+/* Start creating the thumbnail for job. Returns TRUE if a child process
+ * or worker thread is now doing it, or FALSE if it has already finished
+ * (because it was up-to-date, or because it can't be created).
+ * External thumbnailers always run in a child process.
+ */
+static gboolean start_thumb(ThumbJob *job)
+{
+	gboolean	found;
+	MaskedPixmap	*image;
+	pid_t		child;
+	MIME_type       *type;
+	gchar		*thumb_prog;
+	gchar		*thumb_out = NULL, *thumb_size = NULL;
+	const gchar	*path = job->path;
+
+	image = pixmap_try_thumb(path, TRUE);
+
+	if (image)
+	{
+		/* Thumbnail loaded */
+		thumb_job_done(job, TRUE);
+		return FALSE;
+	}
+
+	/* Have we already tried? */
+	image = g_fscache_lookup_full(pixmap_cache, path,
+					FSCACHE_LOOKUP_ONLY_NEW, &found);
+
+	if (found)
+	{
+		/* Thumbnail is known, or failed last time */
+		if (image)
+			g_object_unref(image);
+		thumb_job_done(job, image != NULL);
+		return FALSE;
+	}
+
+	/* Not in memory, nor in the thumbnails directory.  We need to
+	 * generate it */
+
+	type = type_from_path(path);
+	if (!type)
+		type = text_plain;
+
+	/* Add an entry, set to NULL, so no-one else tries to load this
+	 * image.
+	 */
+	g_fscache_insert(pixmap_cache, path, NULL, TRUE);
+
+	thumb_prog = thumbnail_program(type);
+
+	/* Only attempt to load 'images' types ourselves */
+	if (thumb_prog == NULL && strcmp(type->media_type, "image") != 0)
+	{
+		thumb_job_done(job, FALSE);
+		return FALSE;	/* Don't know how to handle this type */
+	}
+
+	if (thumb_prog == NULL && thumb_pool)
+	{
+		/* No need for a new process */
+		job->type = type;
+		job->running = TRUE;
+		thumbs_running++;
+		g_thread_pool_push(thumb_pool, job, NULL);
+		return TRUE;
+	}
+
+	/* Work out the whole command here. Our worker threads may be
+	 * holding locks (eg, for xdgmime or the mount tables) when we
+	 * fork, so the child must not do anything but exec.
+	 */
+	if (thumb_prog)
+	{
+		gchar	*app_run;
+
+		app_run = g_build_filename(thumb_prog, "AppRun", NULL);
+		if (g_file_test(thumb_prog, G_FILE_TEST_IS_DIR) &&
+		    g_file_test(app_run, G_FILE_TEST_IS_EXECUTABLE))
+		{
+			g_free(thumb_prog);
+			thumb_prog = app_run;
+		}
+		else
+			g_free(app_run);
+
+		thumb_out = g_strdup(thumbnail_path(path));
+		thumb_size = g_strdup_printf("%d", PIXMAP_THUMB_SIZE);
+	}
+
+	child = fork();
+
+	if (child == -1)
+	{
+		g_free(thumb_prog);
+		g_free(thumb_out);
+		g_free(thumb_size);
+		delayed_error("fork(): %s", g_strerror(errno));
+		thumb_job_done(job, FALSE);
+		return FALSE;
+	}
+
+	if (child == 0)
+	{
+		/* We are the child process */
+		if (thumb_prog)
+		{
+			execl(thumb_prog, thumb_prog, path,
+			      thumb_out, thumb_size, NULL);
+			_exit(1);
+		}
+
+		/* (only without threads; see thumb_pool) */
+		create_thumbnail(path, type);
+		_exit(0);
+	}
+
+	g_free(thumb_prog);
+	g_free(thumb_out);
+	g_free(thumb_size);
+
+	job->running = TRUE;
+	thumbs_running++;
+	on_child_death(child, (CallbackFn) thumbnail_child_done, job);
+
+	return TRUE;
+}
+
+/* The thumbnail for job has been created (or not). Tell everyone who
+ * was waiting for it and free job.
+ */
+static void thumb_job_done(ThumbJob *job, gboolean success)
+{
+	GList	*next;
+
+	g_hash_table_remove(thumb_jobs, job->path);
+
+	if (job->running)
+	{
+		thumbs_running--;
+		if (thumb_queue && !thumb_idle)
+			thumb_idle = g_idle_add(start_thumbs, NULL);
+	}
+
+	for (next = job->waiters; next; next = next->next)
+	{
+		ThumbWaiter *waiter = (ThumbWaiter *) next->data;
+
+		waiter->callback(waiter->data, success ? job->path : NULL);
+		g_free(waiter);
+	}
+
+	g_list_free(job->waiters);
+	g_free(job->path);
+	g_free(job);
+}
+
+/* A job is as urgent as the most urgent request for it */
+static void update_job_priority(ThumbJob *job)
+{
+	GList	*next;
+	int	priority = G_MAXINT;
+
+	for (next = job->waiters; next; next = next->next)
+	{
+		ThumbWaiter *waiter = (ThumbWaiter *) next->data;
+
+		priority = MIN(priority, waiter->priority);
+	}
+
+	if (priority == job->priority)
+		return;
+
+	job->priority = priority;
+	if (!job->running)
+		thumb_queue_sorted = FALSE;
+}
+
+static gint thumb_job_cmp(gconstpointer a, gconstpointer b)
+{
+	const ThumbJob *ja = (const ThumbJob *) a;
+	const ThumbJob *jb = (const ThumbJob *) b;
+
+	if (ja->priority != jb->priority)
+		return ja->priority < jb->priority ? -1 : 1;
+
+	return ja->serial < jb->serial ? -1 : ja->serial > jb->serial;
+}
+
+static int thumb_max_jobs(void)
+{
+	long	n = o_thumb_jobs.int_value;
+
+	if (n > 0)
+		return n;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return n > 0 ? n : 1;
 }
 
 /* Check if we have an up-to-date thumbnail for this image.
@@ -830,6 +1175,52 @@ static MaskedPixmap *get_bad_image(void)
 	return mp;
 }
 
+static void pixmaps_options_changed(void)
+{
+	if (o_pixmap_cache_size.has_changed)
+		g_fscache_set_budget(pixmap_cache,
+				     (gsize) o_pixmap_cache_size.int_value << 20,
+				     (GFSSizeFunc) masked_pixmap_size);
+}
+
+/* Bytes used by the pixel data of one of mp's pixbufs, unless it shares
+ * it with one we've already counted.
+ */
+static gsize pixbuf_size(GdkPixbuf *pixbuf, GdkPixbuf **counted, int n)
+{
+	int	i;
+
+	if (!pixbuf)
+		return 0;
+
+	for (i = 0; i < n; i++)
+		if (counted[i] == pixbuf)
+			return 0;
+
+	return gdk_pixbuf_get_rowstride(pixbuf) *
+		gdk_pixbuf_get_height(pixbuf);
+}
+
+/* Memory used by mp's images, for pixmap_cache's budget. The huge and
+ * small versions are made on demand, so this grows as mp is used.
+ */
+static gsize masked_pixmap_size(MaskedPixmap *mp, gpointer data)
+{
+	GdkPixbuf *pixbufs[4];
+	gsize	size = sizeof(MaskedPixmap);
+	int	i;
+
+	pixbufs[0] = mp->src_pixbuf;
+	pixbufs[1] = mp->huge_pixbuf;
+	pixbufs[2] = mp->pixbuf;
+	pixbufs[3] = mp->sm_pixbuf;
+
+	for (i = 0; i < G_N_ELEMENTS(pixbufs); i++)
+		size += pixbuf_size(pixbufs[i], pixbufs, i);
+
+	return size;
+}
+
 /* Called now and then to clear out old pixmaps */
 static gint purge(gpointer data)
 {
@@ -958,6 +1349,8 @@ static void load_default_pixmaps(void)
 				 GTK_ICON_SIZE_DIALOG);
 	im_unknown = mp_from_stock(GTK_STOCK_DIALOG_QUESTION,
 				   GTK_ICON_SIZE_DIALOG);
+	im_mount_pending = mp_from_stock(GTK_STOCK_REFRESH,
+					 GTK_ICON_SIZE_DIALOG);
 	
 	im_dirs = load_pixmap("dirs");
 	im_appdir = load_pixmap("application");
@@ -13,6 +13,7 @@ extern GFSCache *desktop_icon_cache;
 
 extern MaskedPixmap *im_error;
 extern MaskedPixmap *im_unknown;
+extern MaskedPixmap *im_mount_pending;
 
 extern MaskedPixmap *im_exec_file;
 extern MaskedPixmap *im_appdir;
@@ -67,7 +68,9 @@ void pixmaps_init(void);
 void pixmap_make_huge(MaskedPixmap *mp);
 void pixmap_make_small(MaskedPixmap *mp);
 MaskedPixmap *load_pixmap(const char *name);
-void pixmap_background_thumb(const gchar *path, GFunc callback, gpointer data);
+gboolean pixmap_background_thumb(const gchar *path, int priority,
+				 GFunc callback, gpointer data);
+void pixmap_cancel_thumbs(gpointer data);
 MaskedPixmap *pixmap_try_thumb(const gchar *path, gboolean can_load);
 MaskedPixmap *masked_pixmap_new(GdkPixbuf *full_size);
 GdkPixbuf *scale_pixbuf(GdkPixbuf *src, int max_w, int max_h);
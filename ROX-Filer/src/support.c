@@ -38,6 +38,13 @@
 #include <libxml/parser.h>
 #include <math.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+# include <linux/fs.h>
+#endif
 
 #include "global.h"
 
@@ -49,11 +56,79 @@
 #include "main.h"
 #include "xml.h"
 
-static GHashTable *uid_hash = NULL;	/* UID -> User name */
-static GHashTable *gid_hash = NULL;	/* GID -> Group name */
+/* How long to remember the names of users and groups, in seconds */
+#define ID_NAME_TTL (10 * 60)
+#define ID_MISSING_TTL 60	/* (for ids with no name) */
+
+/* Most ids remembered, for users and groups separately */
+#define ID_CACHE_SIZE 4096
+
+/* Most names prefetch_id_names() looks up at once */
+#define ID_LOOKUP_THREADS 8
+
+typedef struct _IdCache IdCache;
+typedef struct _IdName IdName;
+typedef struct _IdLookup IdLookup;
+
+struct _IdCache {
+	GHashTable	*names;		/* ID -> IdName */
+	GHashTable	*pending;	/* IDs being looked up in a thread */
+};
+
+struct _IdName {
+	const gchar	*name;		/* Interned */
+	time_t		expires;
+};
+
+/* A name being looked up in a thread, for prefetch_id_names() */
+struct _IdLookup {
+	IdCache		*cache;
+	guint		id;
+	gchar		*name;		/* NULL => not found */
+};
+
+static IdCache user_cache = {NULL, NULL};
+static IdCache group_cache = {NULL, NULL};
+
+/* Finished IdLookups, waiting for names_found() */
+G_LOCK_DEFINE_STATIC(ids_found);
+static GList *ids_found = NULL;
+static guint ids_found_idle = 0;
+
+/* Told about the names names_found() adds to the cache */
+static IdNamesFunc id_names_func = NULL;
+
+/* Most bytes copy_file() copies between progress reports */
+#define COPY_CHUNK (1024 * 1024)
+
+/* Size of the buffer used when copying with read() and write() */
+#define COPY_BUFFER (64 * 1024)
+
+/* How copy_file() is moving the data, best first */
+typedef enum {
+	COPY_RANGE,		/* copy_file_range(), in the kernel */
+	COPY_SENDFILE,		/* sendfile(), in the kernel */
+	COPY_READ_WRITE,	/* Through our own buffer */
+} CopyMethod;
 
 /* Static prototypes */
 static void MD5Transform(guint32 buf[4], guint32 const in[16]);
+static gboolean clone_data(int in, int out);
+static guchar *copy_data(int in, int out, off_t size, CopyMethod method,
+			 CopyProgressFn progress, gpointer data);
+static gssize copy_chunk(int in, int out, CopyMethod *method, char **buffer);
+static gboolean copy_unsupported(int error);
+static guchar *copy_attribs(int out, const struct stat *info);
+static const char *id_name(IdCache *cache, guint id, gboolean wait);
+static void lookup_id_async(IdCache *cache, guint id);
+static IdName *id_cached(IdCache *cache, guint id);
+static gboolean id_expired(gpointer key, gpointer value, gpointer data);
+static IdName *cache_id_name(IdCache *cache, guint id, const gchar *name);
+static gchar *lookup_id(IdCache *cache, guint id);
+static void lookup_thread(gpointer data, gpointer user_data);
+static gboolean names_found(gpointer data);
+static void collate_append_part(GByteArray *key, const gchar *name, gsize len,
+				gboolean final, unsigned long number);
 
 /****************************************************************
  *			EXTERNAL INTERFACE			*
@@ -194,50 +269,288 @@ void debug_free_string(void *data)
 	g_free(data);
 }
 
+/* user_name() and group_name() may need to ask a network directory, so
+ * names are cached. Names which were found are kept for ID_NAME_TTL
+ * seconds; ids with no name are tried again after ID_MISSING_TTL. Names
+ * are interned, so the returned strings are never freed.
+ * These never wait for the directory (if we have threads): an unknown id
+ * is shown as a number, and an expired name is used as it is, while the
+ * name is looked up in the background (see prefetch_id_names()).
+ */
 const char *user_name(uid_t uid)
 {
-	const char *retval;
-	
-	if (!uid_hash)
-		uid_hash = g_hash_table_new(NULL, NULL);
+	return id_name(&user_cache, uid, FALSE);
+}
 
-	retval = g_hash_table_lookup(uid_hash, GINT_TO_POINTER(uid));
+const char *group_name(gid_t gid)
+{
+	return id_name(&group_cache, gid, FALSE);
+}
 
-	if (!retval)
+/* As user_name() and group_name(), but an unknown id is looked up
+ * straight away. For one-off displays which won't be updated later.
+ */
+const char *user_name_now(uid_t uid)
+{
+	return id_name(&user_cache, uid, TRUE);
+}
+
+const char *group_name_now(gid_t gid)
+{
+	return id_name(&group_cache, gid, TRUE);
+}
+
+/* Start looking up the names of all these ids, so that user_name() and
+ * group_name() won't need to. The ones which aren't already cached are
+ * looked up in parallel threads, which is much quicker than one at a time
+ * if each lookup is a network round trip. Doesn't wait for the results;
+ * until they arrive, the ids are shown as numbers and then the function
+ * given to set_id_names_func() is called. Duplicate ids are fine.
+ */
+void prefetch_id_names(const uid_t *uids, int n_uids,
+		       const gid_t *gids, int n_gids)
+{
+	int	i;
+
+	if (!g_thread_supported())
+		return;		/* Just look them up as they're needed */
+
+	for (i = 0; i < n_uids; i++)
+		if (!id_cached(&user_cache, uids[i]))
+			lookup_id_async(&user_cache, uids[i]);
+	for (i = 0; i < n_gids; i++)
+		if (!id_cached(&group_cache, gids[i]))
+			lookup_id_async(&group_cache, gids[i]);
+}
+
+/* func(uids, gids) will be called in the main thread after
+ * prefetch_id_names() finds some names. The hash tables hold the ids
+ * (as keys) whose names have changed.
+ */
+void set_id_names_func(IdNamesFunc func)
+{
+	id_names_func = func;
+}
+
+/* Return the cached name for this id. If it's out-of-date or missing,
+ * start looking it up in the background and return the old name (or the
+ * number) for now. If 'wait' is set, a missing name is looked up straight
+ * away instead. Without threads, we always wait.
+ */
+static const char *id_name(IdCache *cache, guint id, gboolean wait)
+{
+	IdName	*entry = NULL;
+	gchar	*name;
+
+	if (cache->names)
+		entry = g_hash_table_lookup(cache->names, GUINT_TO_POINTER(id));
+	if (entry && entry->expires > time(NULL))
+		return entry->name;
+
+	if (g_thread_supported() && (entry || !wait))
 	{
-		struct passwd *passwd;
+		gchar		*tmp;
+		const char	*number;
+
+		lookup_id_async(cache, id);
+		if (entry)
+			return entry->name;
+
+		tmp = g_strdup_printf("%u", id);
+		number = g_intern_string(tmp);
+		g_free(tmp);
 
-		passwd = getpwuid(uid);
-		retval = passwd ? g_strdup(passwd->pw_name)
-			       : g_strdup_printf("[%d]", (int) uid);
-		g_hash_table_insert(uid_hash, GINT_TO_POINTER(uid),
-				(gchar *) retval);
+		return number;
 	}
 
-	return retval;
+	name = lookup_id(cache, id);
+	entry = cache_id_name(cache, id, name);
+	g_free(name);
+
+	return entry->name;
 }
 
-const char *group_name(gid_t gid)
+/* The cache entry for this id, or NULL if it's missing or out-of-date */
+static IdName *id_cached(IdCache *cache, guint id)
 {
-	const char *retval;
-	
-	if (!gid_hash)
-		gid_hash = g_hash_table_new(NULL, NULL);
+	IdName	*entry;
 
-	retval = g_hash_table_lookup(gid_hash, GINT_TO_POINTER(gid));
+	if (!cache->names)
+		return NULL;
 
-	if (!retval)
+	entry = g_hash_table_lookup(cache->names, GUINT_TO_POINTER(id));
+	if (entry && entry->expires > time(NULL))
+		return entry;
+
+	return NULL;
+}
+
+static gboolean id_expired(gpointer key, gpointer value, gpointer data)
+{
+	return ((IdName *) value)->expires <= *((time_t *) data);
+}
+
+/* Record the name of this id ('name' is NULL if it has none) */
+static IdName *cache_id_name(IdCache *cache, guint id, const gchar *name)
+{
+	IdName	*entry;
+	time_t	now;
+
+	time(&now);
+
+	if (!cache->names)
+		cache->names = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+	if (g_hash_table_size(cache->names) >= ID_CACHE_SIZE)
 	{
-		struct group *group;
+		g_hash_table_foreach_remove(cache->names, id_expired, &now);
+		if (g_hash_table_size(cache->names) >= ID_CACHE_SIZE)
+			g_hash_table_remove_all(cache->names);
+	}
 
-		group = getgrgid(gid);
-		retval = group ? g_strdup(group->gr_name)
-			       : g_strdup_printf("[%d]", (int) gid);
-		g_hash_table_insert(gid_hash, GINT_TO_POINTER(gid),
-				(gchar *) retval);
+	entry = g_new(IdName, 1);
+	if (name)
+	{
+		entry->name = g_intern_string(name);
+		entry->expires = now + ID_NAME_TTL;
 	}
+	else
+	{
+		gchar	*tmp;
 
-	return retval;
+		tmp = g_strdup_printf("[%u]", id);
+		entry->name = g_intern_string(tmp);
+		g_free(tmp);
+		entry->expires = now + ID_MISSING_TTL;
+	}
+
+	g_hash_table_replace(cache->names, GUINT_TO_POINTER(id), entry);
+
+	return entry;
+}
+
+/* Find the name of a user or group, or NULL if it has none. g_free() the
+ * result. Safe to call from any thread.
+ */
+static gchar *lookup_id(IdCache *cache, guint id)
+{
+	struct passwd	pwd, *passwd = NULL;
+	struct group	grp, *group = NULL;
+	gchar		*buffer, *name = NULL;
+	long		size;
+	int		err;
+
+	size = sysconf(cache == &group_cache ? _SC_GETGR_R_SIZE_MAX
+					       : _SC_GETPW_R_SIZE_MAX);
+	if (size <= 0)
+		size = 1024;
+
+	while (1)
+	{
+		buffer = g_malloc(size);
+
+		if (cache == &group_cache)
+		{
+			err = getgrgid_r(id, &grp, buffer, size, &group);
+			if (!err && group)
+				name = g_strdup(group->gr_name);
+		}
+		else
+		{
+			err = getpwuid_r(id, &pwd, buffer, size, &passwd);
+			if (!err && passwd)
+				name = g_strdup(passwd->pw_name);
+		}
+
+		g_free(buffer);
+
+		if (err != ERANGE)
+			break;
+		size *= 2;
+	}
+
+	return name;
+}
+
+/* Look up this id in a thread, unless that's already happening. When
+ * it's done, names_found() will cache the name.
+ */
+static void lookup_id_async(IdCache *cache, guint id)
+{
+	static GThreadPool *pool = NULL;
+	IdLookup *lookup;
+
+	if (!cache->pending)
+		cache->pending = g_hash_table_new(NULL, NULL);
+	else if (g_hash_table_lookup_extended(cache->pending,
+				GUINT_TO_POINTER(id), NULL, NULL))
+		return;
+	g_hash_table_insert(cache->pending, GUINT_TO_POINTER(id), NULL);
+
+	if (!pool)
+		pool = g_thread_pool_new(lookup_thread, NULL,
+				ID_LOOKUP_THREADS, FALSE, NULL);
+
+	lookup = g_new(IdLookup, 1);
+	lookup->cache = cache;
+	lookup->id = id;
+	lookup->name = NULL;
+	g_thread_pool_push(pool, lookup, NULL);
+}
+
+static void lookup_thread(gpointer data, gpointer user_data)
+{
+	IdLookup *lookup = (IdLookup *) data;
+
+	lookup->name = lookup_id(lookup->cache, lookup->id);
+
+	G_LOCK(ids_found);
+	ids_found = g_list_prepend(ids_found, lookup);
+	if (!ids_found_idle)
+		ids_found_idle = g_idle_add(names_found, NULL);
+	G_UNLOCK(ids_found);
+}
+
+/* Idle callback in the main thread. Cache the names found by
+ * lookup_thread() and tell id_names_func about them.
+ */
+static gboolean names_found(gpointer data)
+{
+	GHashTable	*changed[2];
+	GList		*lookups, *next;
+
+	G_LOCK(ids_found);
+	lookups = ids_found;
+	ids_found = NULL;
+	ids_found_idle = 0;
+	G_UNLOCK(ids_found);
+
+	changed[0] = g_hash_table_new(NULL, NULL);
+	changed[1] = g_hash_table_new(NULL, NULL);
+
+	for (next = lookups; next; next = next->next)
+	{
+		IdLookup *lookup = (IdLookup *) next->data;
+		gpointer id = GUINT_TO_POINTER(lookup->id);
+
+		cache_id_name(lookup->cache, lookup->id, lookup->name);
+		g_hash_table_remove(lookup->cache->pending, id);
+		g_hash_table_insert(changed[lookup->cache == &group_cache],
+				    id, NULL);
+
+		g_free(lookup->name);
+		g_free(lookup);
+	}
+
+	g_list_free(lookups);
+
+	if (id_names_func)
+		id_names_func(changed[0], changed[1]);
+
+	g_hash_table_destroy(changed[0]);
+	g_hash_table_destroy(changed[1]);
+
+	return FALSE;
 }
 
 /* Return a string in the form '23 M' in a static buffer valid until
@@ -584,21 +897,251 @@ char *pretty_time(const time_t *time)
 #endif
 
 /* 'from' and 'to' are complete pathnames of files (not dirs or symlinks).
- * This spawns 'cp' to do the copy if lstat() succeeds, otherwise we
- * do the copy manually using vfs.
+ * Regular files are copied here, preserving the mode, owner and
+ * timestamps like 'cp -p'. An existing 'to' is replaced. Other kinds of
+ * file (devices, fifos, etc) are passed to 'cp -pRf'.
+ * If 'clone' is TRUE and the filesystem supports it (eg, btrfs or XFS),
+ * 'to' shares the data blocks of 'from' instead of getting its own copy.
+ * If FALSE, the data is always really copied.
+ * If progress is not NULL, progress(bytes, data) is called as each block
+ * is written.
  *
  * Returns an error string, or NULL on success. g_free() the result.
- *
- * XXX: This was only used for libvfs...
  */
-guchar *copy_file(const guchar *from, const guchar *to)
+guchar *copy_file(const guchar *from, const guchar *to, gboolean clone,
+		  CopyProgressFn progress, gpointer data)
+{
+	struct stat	info;
+	int		in, out;
+	guchar		*error;
+
+	if (mc_lstat(from, &info))
+		return g_strdup(g_strerror(errno));
+
+	if (!S_ISREG(info.st_mode))
+	{
+		const char *argv[] = {"cp", "-pRf", NULL, NULL, NULL};
+
+		argv[2] = from;
+		argv[3] = to;
+
+		return fork_exec_wait(argv);
+	}
+
+	in = open(from, O_RDONLY | O_NOFOLLOW);
+	if (in == -1)
+		return g_strdup(g_strerror(errno));
+
+	out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	if (out == -1 && errno != ENOENT)
+	{
+		/* Like 'cp -f', try removing it first */
+		unlink(to);
+		out = open(to, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	}
+	if (out == -1)
+	{
+		error = g_strdup(g_strerror(errno));
+		close(in);
+		return error;
+	}
+
+	if (clone && clone_data(in, out))
+	{
+		error = NULL;
+		if (progress)
+			progress(info.st_size, data);
+	}
+	else
+		error = copy_data(in, out, info.st_size,
+				  clone ? COPY_RANGE : COPY_SENDFILE,
+				  progress, data);
+	close(in);
+
+	if (error)
+	{
+		close(out);
+		unlink(to);
+		return error;
+	}
+
+	error = copy_attribs(out, &info);
+
+	if (!error)
+	{
+		struct timespec times[2];
+
+		/* (to the nanosecond, like 'cp -p') */
+		times[0] = info.st_atim;
+		times[1] = info.st_mtim;
+		if (futimens(out, times))
+			error = g_strdup(g_strerror(errno));
+	}
+
+	if (close(out) && !error)
+		error = g_strdup(g_strerror(errno));
+
+	return error;
+}
+
+/* Make 'out' share all of the data blocks of 'in', if the filesystem
+ * can do that. This takes the same time however big the file is.
+ * Returns TRUE on success. On failure, 'out' is unchanged.
+ */
+static gboolean clone_data(int in, int out)
+{
+#ifdef FICLONE
+	int	ret;
+
+	do
+		ret = ioctl(out, FICLONE, in);
+	while (ret == -1 && errno == EINTR);
+
+	return ret == 0;
+#else
+	return FALSE;
+#endif
+}
+
+/* Copy everything from 'in' to 'out' (both at their start). 'size' is
+ * the expected size, used to detect files which the kernel can't copy
+ * for us. 'method' is the first method to try; copy_file_range() may
+ * share blocks rather than copying them, so start at COPY_SENDFILE to
+ * force a real copy. Returns an error string, or NULL on success.
+ */
+static guchar *copy_data(int in, int out, off_t size, CopyMethod method,
+			 CopyProgressFn progress, gpointer data)
+{
+	char		*buffer = NULL;
+	off_t		total = 0;
+	gssize		got;
+
+	while ((got = copy_chunk(in, out, &method, &buffer)))
+	{
+		if (got == -1)
+		{
+			g_free(buffer);
+			return g_strdup(g_strerror(errno));
+		}
+
+		total += got;
+		if (progress)
+			progress(got, data);
+	}
+
+	g_free(buffer);
+
+	/* Some files (eg, in /proc) claim to be empty to the kernel
+	 * copying functions, but aren't. Retry the slow way.
+	 */
+	if (total == 0 && size > 0 && method != COPY_READ_WRITE)
+	{
+		method = COPY_READ_WRITE;
+		while ((got = copy_chunk(in, out, &method, &buffer)))
+		{
+			if (got == -1)
+			{
+				g_free(buffer);
+				return g_strdup(g_strerror(errno));
+			}
+			if (progress)
+				progress(got, data);
+		}
+		g_free(buffer);
+	}
+
+	return NULL;
+}
+
+/* Copy up to COPY_CHUNK bytes using the best available method, falling
+ * back to the next one (and updating 'method') if the kernel can't do it.
+ * *buffer is allocated if needed; g_free() it when done.
+ * Returns the number of bytes copied, 0 at the end, or -1 on error.
+ */
+static gssize copy_chunk(int in, int out, CopyMethod *method, char **buffer)
+{
+	gssize	got, done, n;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (*method == COPY_RANGE)
+	{
+		do
+			got = copy_file_range(in, NULL, out, NULL,
+					      COPY_CHUNK, 0);
+		while (got == -1 && errno == EINTR);
+
+		if (got != -1 || !copy_unsupported(errno))
+			return got;
+	}
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+	if (*method <= COPY_SENDFILE)
+	{
+		*method = COPY_SENDFILE;
+		do
+			got = sendfile(out, in, NULL, COPY_CHUNK);
+		while (got == -1 && errno == EINTR);
+
+		if (got != -1 || !copy_unsupported(errno))
+			return got;
+	}
+#endif
+	*method = COPY_READ_WRITE;
+
+	if (!*buffer)
+		*buffer = g_malloc(COPY_BUFFER);
+
+	do
+		got = read(in, *buffer, COPY_BUFFER);
+	while (got == -1 && errno == EINTR);
+
+	for (done = 0; done < got; done += n)
+	{
+		n = write(out, *buffer + done, got - done);
+		if (n == -1)
+		{
+			if (errno != EINTR)
+				return -1;
+			n = 0;
+		}
+	}
+
+	return got;
+}
+
+/* TRUE if this error from copy_file_range() or sendfile() means that it
+ * won't work for these files, rather than that the copy failed.
+ */
+static gboolean copy_unsupported(int error)
 {
-	const char *argv[] = {"cp", "-pRf", NULL, NULL, NULL};
+	return error == ENOSYS || error == EINVAL || error == EXDEV ||
+		error == EOPNOTSUPP || error == EBADF;
+}
 
-	argv[2] = from;
-	argv[3] = to;
+/* Give 'out' the owner and permissions from 'info', as far as we're
+ * allowed to. Returns an error string, or NULL on success.
+ */
+static guchar *copy_attribs(int out, const struct stat *info)
+{
+	mode_t	mode = info->st_mode & 07777;
+
+	/* Only root can give files away. Like 'cp -p', ignore this, but
+	 * don't create setuid/setgid files owned by the wrong user.
+	 */
+	if (fchown(out, info->st_uid, info->st_gid))
+	{
+		mode &= ~S_ISUID;
+		if (fchown(out, -1, info->st_gid))
+			mode &= ~S_ISGID;
+	}
+
+	/* Some filesystems don't support SetGID and SetUID bits.
+	 * Ignore these errors.
+	 */
+	if (fchmod(out, mode) && errno != EPERM)
+		return g_strdup(g_strerror(errno));
 
-	return fork_exec_wait(argv);
+	return NULL;
 }
 
 /* 'word' has all special characters escaped so that it may be inserted
@@ -1162,36 +1705,38 @@ void null_g_free(gpointer p)
 	*(gpointer *)p = NULL;
 }
 
-typedef struct _CollatePart CollatePart;
-
+/* A CollateKey is a single block of bytes, ordered by memcmp(). It starts
+ * with a byte which is 0 for names starting with a capital letter (1
+ * otherwise), followed by each (text, number) part of the name in turn:
+ *
+ *	text	From g_utf8_collate_key(), which never contains nul
+ *	0	Ends the text (and sorts before any other text byte)
+ *	tag	0 for the final part, which has no number, or 1 + n
+ *	n bytes	The number, big-endian, without leading zero bytes
+ *
+ * Numbers with fewer bytes are smaller, so the tag byte orders numbers
+ * before their digits are compared.
+ */
 struct _CollateKey {
-	CollatePart *parts;
-	gboolean caps;
+	gsize len;		/* Not including the caps byte */
+	guchar bytes[1];	/* Caps byte, then the parts */
 };
 
-struct _CollatePart {
-	guchar *text;	/* NULL => end of list */
-	long number;
-};
-
-/* Break 'name' (a UTF-8 string) down into a list of (text, number) pairs.
- * The text parts processed for collating. This allows any two names to be
- * quickly compared later for intelligent sorting (comparing names is
- * speed-critical).
+/* Break 'name' (a UTF-8 string) down into a list of (text, number) pairs,
+ * with the text parts processed for collating, and flatten them into a
+ * single key. This allows any two names to be quickly compared later for
+ * intelligent sorting (comparing names is speed-critical).
  */
 CollateKey *collate_key_new(const guchar *name)
 {
 	const guchar *i;
 	guchar *to_free = NULL;
-	GArray *array;
-	CollatePart new;
+	GByteArray *bytes;
 	CollateKey *retval;
-	char *tmp;
+	guchar caps;
 
 	g_return_val_if_fail(name != NULL, NULL);
 
-	array = g_array_new(FALSE, FALSE, sizeof(CollatePart));
-
 	/* Ensure valid UTF-8 */
 	if (!g_utf8_validate(name, -1, NULL))
 	{
@@ -1199,8 +1744,9 @@ CollateKey *collate_key_new(const guchar *name)
 		name = to_free;
 	}
 
-	retval = g_new(CollateKey, 1);
-	retval->caps = g_unichar_isupper(g_utf8_get_char(name));
+	bytes = g_byte_array_new();
+	caps = g_unichar_isupper(g_utf8_get_char(name)) ? 0 : 1;
+	g_byte_array_append(bytes, &caps, 1);
 
 	for (i = name; *i; i = g_utf8_next_char(i))
 	{
@@ -1215,14 +1761,12 @@ CollateKey *collate_key_new(const guchar *name)
 		if (first_char >= '0' && first_char <= '9')
 		{
 			char *endp;
+			unsigned long number;
 			
 			/* i -> first digit character */
-			tmp = g_utf8_strdown(name, i - name);
-			new.text = g_utf8_collate_key(tmp, -1);
-			g_free(tmp);
-			new.number = strtol(i, &endp, 10);
-
-			g_array_append_val(array, new);
+			number = strtoul(i, &endp, 10);
+			collate_append_part(bytes, name, i - name,
+					    FALSE, number);
 
 			g_return_val_if_fail(endp > (char *) i, NULL);
 
@@ -1231,17 +1775,12 @@ CollateKey *collate_key_new(const guchar *name)
 		}
 	}
 
-	tmp = g_utf8_strdown(name, i - name);
-	new.text = g_utf8_collate_key(tmp, -1);
-	g_free(tmp);
-	new.number = -1;
-	g_array_append_val(array, new);
+	collate_append_part(bytes, name, i - name, TRUE, 0);
 
-	new.text = NULL;
-	g_array_append_val(array, new);
-
-	retval->parts = (CollatePart *) array->data;
-	g_array_free(array, FALSE);
+	retval = g_malloc(G_STRUCT_OFFSET(CollateKey, bytes) + bytes->len);
+	retval->len = bytes->len - 1;
+	memcpy(retval->bytes, bytes->data, bytes->len);
+	g_byte_array_free(bytes, TRUE);
 
 	if (to_free)
 		g_free(to_free);	/* Only taken for invalid UTF-8 */
@@ -1251,47 +1790,108 @@ CollateKey *collate_key_new(const guchar *name)
 
 void collate_key_free(CollateKey *key)
 {
-	CollatePart *part;
-
-	for (part = key->parts; part->text; part++)
-		g_free(part->text);
-	g_free(key->parts);
 	g_free(key);
 }
 
+/* The number of bytes used by 'key' */
+gsize collate_key_size(const CollateKey *key)
+{
+	return G_STRUCT_OFFSET(CollateKey, bytes) + key->len + 1;
+}
+
 int collate_key_cmp(const CollateKey *key1, const CollateKey *key2,
 		    gboolean caps_first)
 {
-	CollatePart *n1 = key1->parts;
-	CollatePart *n2 = key2->parts;
+	/* Without caps_first, skip the caps byte */
+	const guchar *b1 = key1->bytes + (caps_first ? 0 : 1);
+	const guchar *b2 = key2->bytes + (caps_first ? 0 : 1);
 	int r;
 
-	if (caps_first)
+	r = memcmp(b1, b2, MIN(key1->len, key2->len) + (caps_first ? 1 : 0));
+	if (r)
+		return r;
+
+	if (key1->len < key2->len)
+		return -1;
+	return key1->len > key2->len ? 1 : 0;
+}
+
+/* Add one (text, number) part to a CollateKey. 'name' need not be
+ * nul-terminated. The number is ignored for the final part.
+ */
+static void collate_append_part(GByteArray *key, const gchar *name, gsize len,
+				gboolean final, unsigned long number)
+{
+	guchar	digits[sizeof(number) + 1];
+	gchar	*down, *text;
+	int	n = 0;
+
+	down = g_utf8_strdown(name, len);
+	text = g_utf8_collate_key(down, -1);
+	g_byte_array_append(key, text, strlen(text) + 1);
+	g_free(text);
+	g_free(down);
+
+	if (final)
 	{
-		if (key1->caps && !key2->caps)
-			return -1;
-		else if (key2->caps && !key1->caps)
-			return 1;
+		digits[0] = 0;
+		g_byte_array_append(key, digits, 1);
+		return;
 	}
 
-	while (1)
+	for (; number; number >>= 8)
+		digits[sizeof(number) - n++] = number & 0xff;
+	digits[sizeof(number) - n] = n + 1;
+	g_byte_array_append(key, digits + sizeof(number) - n, n + 1);
+}
+
+/* Sort an array of 'n' elements of 'size' bytes, like g_qsort_with_data().
+ * Views usually have a sorted list with new items appended, so only the
+ * elements after the initial sorted run are sorted, and are then merged
+ * into it. A fully sorted array costs one comparison per element.
+ * If the caller knows that the first 'sorted' elements are in order, they
+ * aren't checked again. The sort is stable.
+ */
+void sort_appended(gpointer base, gint n, gint sorted, gsize size,
+		   GCompareDataFunc compare, gpointer data)
+{
+	guchar	*array = base;
+	guchar	*tail;
+	gint	n_tail, i, j, k;
+
+	for (sorted = MAX(sorted, 1); sorted < n; sorted++)
 	{
-		if (!n1->text)
-			return n2->text ? -1 : 0;
-		if (!n2->text)
-			return 1;
-		r = strcmp(n1->text, n2->text);
-		if (r)
-			return r;
+		if (compare(array + (sorted - 1) * size,
+			    array + sorted * size, data) > 0)
+			break;
+	}
+	if (sorted >= n)
+		return;
 
-		if (n1->number < n2->number)
-			return -1;
-		if (n1->number > n2->number)
-			return 1;
+	n_tail = n - sorted;
+	g_qsort_with_data(array + sorted * size, n_tail, size, compare, data);
+
+	/* New items which sort after all the old ones are already in place */
+	if (compare(array + (sorted - 1) * size,
+		    array + sorted * size, data) <= 0)
+		return;
 
-		n1++;
-		n2++;
+	/* Merge from the end, so that the old items only move once */
+	tail = g_memdup(array + sorted * size, n_tail * size);
+	i = sorted - 1;
+	j = n_tail - 1;
+	k = n - 1;
+
+	while (j >= 0)
+	{
+		if (i >= 0 && compare(array + i * size, tail + j * size,
+				      data) > 0)
+			memcpy(array + k-- * size, array + i-- * size, size);
+		else
+			memcpy(array + k-- * size, tail + j-- * size, size);
 	}
+
+	g_free(tail);
 }
 
 /* Returns TRUE if the object exists, FALSE if it doesn't.
@@ -11,6 +11,12 @@
 
 #include <glib-object.h>
 
+/* Called by copy_file() after each block is copied */
+typedef void (*CopyProgressFn)(off_t bytes, gpointer data);
+
+/* Called when prefetch_id_names() has found some names */
+typedef void (*IdNamesFunc)(GHashTable *uids, GHashTable *gids);
+
 XMLwrapper *xml_cache_load(const gchar *pathname);
 int save_xml_file(xmlDocPtr doc, const gchar *filename);
 xmlDocPtr soap_new(xmlNodePtr *ret_body);
@@ -21,6 +27,11 @@ const char *our_host_name_for_dnd(void);
 void debug_free_string(void *data);
 const char *user_name(uid_t uid);
 const char *group_name(gid_t gid);
+const char *user_name_now(uid_t uid);
+const char *group_name_now(gid_t gid);
+void prefetch_id_names(const uid_t *uids, int n_uids,
+		       const gid_t *gids, int n_gids);
+void set_id_names_func(IdNamesFunc func);
 const char *format_size(off_t size);
 const char *format_size_aligned(off_t size);
 const gchar *format_double_size(double size);
@@ -31,7 +42,8 @@ char *get_local_path(const EscapedPath *escaped_uri);
 void close_on_exec(int fd, gboolean close);
 void set_blocking(int fd, gboolean blocking);
 char *pretty_time(const time_t *time);
-guchar *copy_file(const guchar *from, const guchar *to);
+guchar *copy_file(const guchar *from, const guchar *to, gboolean clone,
+		  CopyProgressFn progress, gpointer data);
 guchar *shell_escape(const guchar *word);
 gboolean is_sub_dir(const char *sub, const char *parent);
 gboolean in_list(const guchar *item, const guchar *list);
@@ -48,8 +60,11 @@ void destroy_glist(GList **list);
 void null_g_free(gpointer p);
 CollateKey *collate_key_new(const guchar *name);
 void collate_key_free(CollateKey *key);
+gsize collate_key_size(const CollateKey *key);
 int collate_key_cmp(const CollateKey *n1, const CollateKey *n2,
 		    gboolean caps_first);
+void sort_appended(gpointer base, gint n, gint sorted, gsize size,
+		   GCompareDataFunc compare, gpointer data);
 gboolean file_exists(const char *path);
 GPtrArray *list_dir(const guchar *path);
 gint strcmp2(gconstpointer a, gconstpointer b);
@@ -30,6 +30,7 @@
 #include <fnmatch.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #ifdef WITH_GNOMEVFS
 # include <libgnomevfs/gnome-vfs.h>
@@ -92,6 +93,8 @@ static MIME_type *get_mime_type(const gchar *type_name, gboolean can_create);
 static gboolean remove_handler_with_confirm(const guchar *path);
 static void set_icon_theme(void);
 static GList *build_icon_theme(Option *option, xmlNode *node, guchar *label);
+static void lock_for_fork(void);
+static void unlock_after_fork(void);
 
 /* Hash of all allocated MIME types, indexed by "media/subtype".
  * MIME_type structs are never freed; this table prevents memory leaks
@@ -99,6 +102,9 @@ static GList *build_icon_theme(Option *option, xmlNode *node, guchar *label);
  */
 static GHashTable *type_hash = NULL;
 
+/* The xdgmime library isn't thread-safe. Hold this lock while calling it. */
+G_LOCK_DEFINE_STATIC(xdg_mime);
+
 /* Most things on Unix are text files, so this is the default type */
 MIME_type *text_plain;
 MIME_type *inode_directory;
@@ -129,6 +135,11 @@ void type_init(void)
 	
 	type_hash = g_hash_table_new(g_str_hash, g_str_equal);
 
+	/* Worker threads call xdgmime, and action windows fork() without
+	 * exec(). Don't fork while a thread holds the lock.
+	 */
+	pthread_atfork(lock_for_fork, unlock_after_fork, unlock_after_fork);
+
 	text_plain = get_mime_type("text/plain", TRUE);
 	inode_directory = get_mime_type("inode/directory", TRUE);
 	inode_mountpoint = get_mime_type("inode/mount-point", TRUE);
@@ -166,7 +177,9 @@ void reread_mime_files(void)
 {
 	gtk_icon_theme_rescan_if_needed(icon_theme);
 
+	G_LOCK(xdg_mime);
 	xdg_mime_shutdown();
+	G_UNLOCK(xdg_mime);
 
 	filer_update_all();
 }
@@ -200,8 +213,10 @@ static MIME_type *get_mime_type(const gchar *type_name, gboolean can_create)
 	mtype->image = NULL;
 	mtype->comment = NULL;
 
+	G_LOCK(xdg_mime);
 	mtype->executable = xdg_mime_mime_type_subclass(type_name,
 						"application/x-executable");
+	G_UNLOCK(xdg_mime);
 
 	g_hash_table_insert(type_hash, g_strdup(type_name), mtype);
 
@@ -307,19 +322,104 @@ MIME_type *type_get_type(const guchar *path)
 MIME_type *type_from_path(const char *path)
 {
 	MIME_type *mime_type = NULL;
-	const char *type_name;
+	gchar *type_name;
+
+	type_name = type_name_from_path(path);
+	if (type_name)
+	{
+		mime_type = get_mime_type(type_name, TRUE);
+		g_free(type_name);
+	}
+
+	return mime_type;
+}
+
+/* As type_from_path(), but returns the name of the type instead of a
+ * MIME_type (which may only be created by the main thread).
+ * This may be called from any thread. The file is read without holding
+ * the xdgmime lock, so a slow filesystem doesn't hold up other callers.
+ * g_free() the result. NULL if we can't think of anything.
+ */
+gchar *type_name_from_path(const char *path)
+{
+	const char	*types[5];
+	const char	*type_name;
+	gchar		*retval = NULL;
+	gchar		*guess = NULL;	/* Best match by name, if ambiguous */
+	guchar		*data;
+	struct stat	info;
+	int		n, max_extent, prio, fd;
+	ssize_t		got;
 
 	/* Check for extended attribute first */
-	mime_type = xtype_get(path);
-	if (mime_type)
-		return mime_type;
+	retval = xattr_get(path, XATTR_MIME_TYPE, NULL);
+	if (retval)
+	{
+		char *nl;
+
+		nl = strchr(retval, '\n');
+		if (nl)
+			*nl = '\0';
+		if (strchr(retval, '/'))
+			return retval;
+		null_g_free(&retval);
+	}
 
-	/* Try name and contents next */
-	type_name = xdg_mime_get_mime_type_for_file(path, NULL);
-	if (type_name)
-		return get_mime_type(type_name, TRUE);
+	if (!g_utf8_validate(path, -1, NULL))
+		return NULL;
+
+	/* Try the name next */
+	G_LOCK(xdg_mime);
+	n = xdg_mime_get_mime_types_from_file_name(g_basename(path),
+						   types, G_N_ELEMENTS(types));
+	if (n == 1)
+		retval = g_strdup(types[0]);
+	else if (n > 1)
+		guess = g_strdup(types[0]);
+	max_extent = xdg_mime_get_max_buffer_extents();
+	G_UNLOCK(xdg_mime);
+
+	if (retval)
+		return retval;
+
+	/* Then the contents */
+	if (mc_stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+		goto out;
+	if (info.st_size == 0)
+	{
+		retval = g_strdup(XDG_MIME_TYPE_EMPTY);
+		goto out;
+	}
+
+	fd = mc_open(path, O_RDONLY);
+	if (fd == -1)
+		goto out;
+	data = g_malloc(max_extent);
+	got = mc_read(fd, data, max_extent);
+	mc_close(fd);
+
+	if (got > 0)
+	{
+		G_LOCK(xdg_mime);
+		type_name = xdg_mime_get_mime_type_for_data(data, got, &prio);
+		/* If no magic rule matched, we just get told whether it
+		 * looks like text or not. The name is a better guess.
+		 */
+		if (strcmp(type_name, XDG_MIME_TYPE_UNKNOWN) != 0 &&
+		    !(guess && strcmp(type_name, XDG_MIME_TYPE_TEXTPLAIN) == 0))
+			retval = g_strdup(type_name);
+		G_UNLOCK(xdg_mime);
+	}
 
-	return NULL;
+	g_free(data);
+out:
+	/* Contents didn't help; go with the name if we can */
+	if (!retval)
+		retval = guess ? guess : g_strdup(XDG_MIME_TYPE_UNKNOWN);
+	else
+		g_free(guess);
+
+	return retval;
 }
 
 /* Returns the file/dir in Choices for handling this type.
@@ -1486,3 +1586,13 @@ GdkPixbuf *theme_load_icon(const gchar *icon_name, gint size,
 	return result;
 }
 
+/* pthread_atfork() handlers; see type_init() */
+static void lock_for_fork(void)
+{
+	G_LOCK(xdg_mime);
+}
+
+static void unlock_after_fork(void)
+{
+	G_UNLOCK(xdg_mime);
+}
@@ -168,6 +168,10 @@ static void view_collection_start_lasso_box(ViewIface *view,
 static void view_collection_extend_tip(ViewIface *view, ViewIter *iter,
 					GString *tip);
 static gboolean view_collection_auto_scroll_callback(ViewIface *view);
+static void view_collection_get_visible_limits(ViewIface *view,
+					       int *first, int *last);
+static int view_collection_visible_distance(ViewIface *view, ViewIter *iter,
+					    int first, int last);
 
 static DirItem *iter_next(ViewIter *iter);
 static DirItem *iter_prev(ViewIter *iter);
@@ -711,6 +715,8 @@ static void view_collection_iface_init(gpointer giface, gpointer iface_data)
 	iface->start_lasso_box = view_collection_start_lasso_box;
 	iface->extend_tip = view_collection_extend_tip;
 	iface->auto_scroll_callback = view_collection_auto_scroll_callback;
+	iface->get_visible_limits = view_collection_get_visible_limits;
+	iface->visible_distance = view_collection_visible_distance;
 }
 
 static void view_collection_extend_tip(ViewIface *view, ViewIter *iter,
@@ -1071,7 +1077,8 @@ static void view_collection_add_items(ViewIface *view, GPtrArray *items)
 	}
 
 	if (old_num != collection->number_of_items)
-		view_collection_sort(view);
+		collection_sort_added(collection, sort_fn(filer_window),
+				      filer_window->sort_order, old_num);
 }
 
 static void view_collection_update_items(ViewIface *view, GPtrArray *items)
@@ -1603,3 +1610,27 @@ static gboolean view_collection_auto_scroll_callback(ViewIface *view)
 
 	return TRUE;
 }
+
+static void view_collection_get_visible_limits(ViewIface *view,
+					       int *first, int *last)
+{
+	Collection	*collection = ((ViewCollection *) view)->collection;
+
+	collection_get_visible_limits(collection, first, last);
+}
+
+/* first and last are rows, from view_collection_get_visible_limits() */
+static int view_collection_visible_distance(ViewIface *view, ViewIter *iter,
+					    int first, int last)
+{
+	Collection	*collection = ((ViewCollection *) view)->collection;
+	int		row, col;
+
+	collection_item_to_rowcol(collection, iter->i, &row, &col);
+
+	if (row < first)
+		return first - row;
+	if (row > last)
+		return row - last;
+	return 0;
+}
@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 
@@ -56,6 +58,9 @@
 #define COL_VIEW_ITEM 10
 #define N_COLUMNS 11
 
+/* Rows measured to choose column widths for fixed-size rows */
+#define WIDTH_SAMPLE_ROWS 500
+
 static gpointer parent_class = NULL;
 
 struct _ViewDetailsClass {
@@ -102,6 +107,13 @@ static void view_details_start_lasso_box(ViewIface *view,
 static void view_details_extend_tip(ViewIface *view,
 				    ViewIter *iter, GString *tip);
 static gboolean view_details_auto_scroll_callback(ViewIface *view);
+static void view_details_get_visible_limits(ViewIface *view,
+					    int *first, int *last);
+static int view_details_visible_distance(ViewIface *view, ViewIter *iter,
+					 int first, int last);
+static void fix_column_widths(ViewDetails *view_details, int sizing);
+static void widen_columns(ViewDetails *view_details, int sizing,
+			  const gint *rows, gint n);
 
 static DirItem *iter_peek(ViewIter *iter);
 static DirItem *iter_prev(ViewIter *iter);
@@ -268,6 +280,73 @@ static GtkTreePath *details_get_path(GtkTreeModel *tree_model,
 	return retval;
 }
 
+/* Append one column's text to 'columns' (NULL is shown as blank) */
+static void add_column(GString *columns, const gchar *text)
+{
+	if (text)
+		g_string_append(columns, text);
+	g_string_append_c(columns, '\0');
+}
+
+/* Format the text for the COL_TYPE to COL_MTIME columns, in order, as a
+ * single block of nul-terminated strings.
+ */
+static gchar *format_columns(DirItem *item)
+{
+	GString	*columns;
+	gchar	*time;
+	mode_t	m = item->mode;
+
+	columns = g_string_new(NULL);
+
+	if (o_display_show_full_type.int_value)
+		add_column(columns,
+			   item->flags & ITEM_FLAG_APPDIR? "Application" :
+			   mime_type_comment(item->mime_type));
+	else
+		add_column(columns,
+			   item->flags & ITEM_FLAG_APPDIR? "App" :
+			   S_ISDIR(m) ? "Dir" :
+			   S_ISCHR(m) ? "Char" :
+			   S_ISBLK(m) ? "Blck" :
+			   S_ISLNK(m) ? "Link" :
+			   S_ISSOCK(m) ? "Sock" :
+			   S_ISFIFO(m) ? "Pipe" :
+			   S_ISDOOR(m) ? "Door" :
+			   "File");
+
+	add_column(columns, pretty_permissions(m));
+	add_column(columns, user_name(item->uid));
+	add_column(columns, group_name(item->gid));
+	add_column(columns, item->base_type != TYPE_DIRECTORY
+				? format_size(item->size) : NULL);
+
+	time = pretty_time(&item->mtime);
+	add_column(columns, time);
+	g_free(time);
+
+	return g_string_free(columns, FALSE);
+}
+
+/* The text for one of the COL_TYPE to COL_MTIME columns. Formatting is
+ * slow and GtkTreeView asks often, so the text for all of them is cached
+ * until the item is updated.
+ */
+static const gchar *column_text(ViewItem *view_item, int column)
+{
+	const gchar *text;
+	int	i;
+
+	if (!view_item->columns)
+		view_item->columns = format_columns(view_item->item);
+
+	text = view_item->columns;
+	for (i = COL_TYPE; i < column; i++)
+		text += strlen(text) + 1;
+
+	return text;
+}
+
 static void details_get_value(GtkTreeModel *tree_model,
 			      GtkTreeIter  *iter,
 			      gint         column,
@@ -278,7 +357,6 @@ static void details_get_value(GtkTreeModel *tree_model,
 	GPtrArray *items = view_details->items;
 	ViewItem *view_item;
 	DirItem *item;
-	mode_t m;
 
 	g_return_if_fail(column >= 0 && column < N_COLUMNS);
 
@@ -324,7 +402,6 @@ static void details_get_value(GtkTreeModel *tree_model,
 			     
 		return;
 	}
-	m = item->mode;
 
 	switch (column)
 	{
@@ -346,51 +423,16 @@ static void details_get_value(GtkTreeModel *tree_model,
 				g_value_set_boxed(value,
 						  type_get_colour(item, NULL));
 			break;
+		case COL_TYPE:
+		case COL_PERM:
 		case COL_OWNER:
-			g_value_init(value, G_TYPE_STRING);
-			g_value_set_string(value, user_name(item->uid));
-			break;
 		case COL_GROUP:
-			g_value_init(value, G_TYPE_STRING);
-			g_value_set_string(value, group_name(item->gid));
-			break;
-		case COL_MTIME:
-		{
-			gchar *time;
-			time = pretty_time(&item->mtime);
-			g_value_init(value, G_TYPE_STRING);
-			g_value_set_string(value, time);
-			g_free(time);
-			break;
-		}
-		case COL_PERM:
-			g_value_init(value, G_TYPE_STRING);
-			g_value_set_string(value, pretty_permissions(m));
-			break;
 		case COL_SIZE:
+		case COL_MTIME:
+			/* (the cache outlives the value) */
 			g_value_init(value, G_TYPE_STRING);
-			if (item->base_type != TYPE_DIRECTORY)
-				g_value_set_string(value,
-						   format_size(item->size));
-			break;
-		case COL_TYPE:
-			g_value_init(value, G_TYPE_STRING);
-			if(o_display_show_full_type.int_value)
-				g_value_set_string(value, 
-						   item->flags & ITEM_FLAG_APPDIR? "Application" :
-						   mime_type_comment(item->mime_type));
-			else
-				g_value_set_string(value, 
-						   item->flags & ITEM_FLAG_APPDIR? "App" :
-						   S_ISDIR(m) ? "Dir" :
-						   S_ISCHR(m) ? "Char" :
-						   S_ISBLK(m) ? "Blck" :
-						   S_ISLNK(m) ? "Link" :
-						   S_ISSOCK(m) ? "Sock" :
-						   S_ISFIFO(m) ? "Pipe" :
-						   S_ISDOOR(m) ? "Door" :
-						   "File");
-			
+			g_value_set_static_string(value,
+					column_text(view_item, column));
 			break;
 		case COL_WEIGHT:
 			g_value_init(value, G_TYPE_INT);
@@ -1029,6 +1071,7 @@ static void view_details_init(GTypeInstance *object, gpointer gclass)
 	view_details->desired_size.width = -1;
 	view_details->desired_size.height = -1;
 	view_details->can_change_selection = 0;
+	view_details->fixed_rows = FALSE;
 	view_details->lasso_box = FALSE;
 
 	view_details->selection = gtk_tree_view_get_selection(treeview);
@@ -1112,6 +1155,8 @@ static void view_details_iface_init(gpointer giface, gpointer iface_data)
 	iface->start_lasso_box = view_details_start_lasso_box;
 	iface->extend_tip = view_details_extend_tip;
 	iface->auto_scroll_callback = view_details_auto_scroll_callback;
+	iface->get_visible_limits = view_details_get_visible_limits;
+	iface->visible_distance = view_details_visible_distance;
 }
 
 /* Implementations of the View interface. See view_iface.c for comments. */
@@ -1139,13 +1184,17 @@ static void view_details_style_changed(ViewIface *view, int flags)
 			g_object_unref(G_OBJECT(item->image));
 			item->image = NULL;
 		}
+		null_g_free(&item->columns);
 		gtk_tree_model_row_changed(model, path, &iter);
 		gtk_tree_path_next(path);
 	}
 
 	gtk_tree_path_free(path);
 
-	gtk_tree_view_columns_autosize((GtkTreeView *) view);
+	if (view_details->fixed_rows)
+		fix_column_widths(view_details, -1);
+	else
+		gtk_tree_view_columns_autosize((GtkTreeView *) view);
 
 	if (flags & VIEW_UPDATE_HEADERS)
 		details_update_header_visibility(view_details);
@@ -1163,6 +1212,22 @@ static gint wrap_sort(gconstpointer a, gconstpointer b,
 		return -view_details->sort_fn(ia->item, ib->item);
 }
 
+/* Set sort_fn from the filer window's sort type */
+static void set_sort_fn(ViewDetails *view_details)
+{
+	switch (view_details->filer_window->sort_type)
+	{
+		case SORT_NAME: view_details->sort_fn = sort_by_name; break;
+		case SORT_TYPE: view_details->sort_fn = sort_by_type; break;
+		case SORT_DATE: view_details->sort_fn = sort_by_date; break;
+		case SORT_SIZE: view_details->sort_fn = sort_by_size; break;
+		case SORT_OWNER: view_details->sort_fn = sort_by_owner; break;
+		case SORT_GROUP: view_details->sort_fn = sort_by_group; break;
+		default:
+			g_assert_not_reached();
+	}
+}
+
 static void resort(ViewDetails *view_details)
 {
 	ViewItem **items = (ViewItem **) view_details->items->pdata;
@@ -1177,21 +1242,10 @@ static void resort(ViewDetails *view_details)
 	for (i = len - 1; i >= 0; i--)
 		items[i]->old_pos = i;
 
-	switch (view_details->filer_window->sort_type)
-	{
-		case SORT_NAME: view_details->sort_fn = sort_by_name; break;
-		case SORT_TYPE: view_details->sort_fn = sort_by_type; break;
-		case SORT_DATE: view_details->sort_fn = sort_by_date; break;
-		case SORT_SIZE: view_details->sort_fn = sort_by_size; break;
-		case SORT_OWNER: view_details->sort_fn = sort_by_owner; break;
-		case SORT_GROUP: view_details->sort_fn = sort_by_group; break;
-		default:
-			g_assert_not_reached();
-	}
-	
-	g_ptr_array_sort_with_data(view_details->items,
-				   (GCompareDataFunc) wrap_sort,
-				   view_details);
+	set_sort_fn(view_details);
+
+	sort_appended(items, len, 0, sizeof(ViewItem *),
+		      (GCompareDataFunc) wrap_sort, view_details);
 
 	new_order = g_new(guint, len);
 	for (i = len - 1; i >= 0; i--)
@@ -1210,6 +1264,185 @@ static void resort(ViewDetails *view_details)
 	g_free(new_order);
 }
 
+/* The width needed to show 'column' for an even sample of the rows (or
+ * of just the 'n' rows listed in 'rows', if it isn't NULL)
+ */
+static int sample_width(ViewDetails *view_details, GtkTreeViewColumn *column,
+			const gint *rows, gint n)
+{
+	GtkTreeModel *model = (GtkTreeModel *) view_details;
+	GtkTreeIter iter;
+	GtkRequisition req;
+	gint i;
+	gint w, width, step, sep;
+
+	if (!rows)
+		n = view_details->items->len;
+	step = MAX(1, n / WIDTH_SAMPLE_ROWS);
+	width = gtk_tree_view_column_get_width(column);
+
+	if (column->button)
+	{
+		gtk_widget_size_request(column->button, &req);
+		width = MAX(width, req.width);
+	}
+
+	for (i = 0; i < n; i += step)
+	{
+		iter.user_data = GINT_TO_POINTER(rows ? rows[i] : i);
+		gtk_tree_view_column_cell_set_cell_data(column, model, &iter,
+							FALSE, FALSE);
+		gtk_tree_view_column_cell_get_size(column, NULL, NULL, NULL,
+						   &w, NULL);
+		width = MAX(width, w);
+	}
+
+	gtk_widget_style_get(GTK_WIDGET(view_details),
+			     "horizontal-separator", &sep, NULL);
+
+	return width + sep;
+}
+
+/* Set the sizing mode of each column. For GTK_TREE_VIEW_COLUMN_FIXED (or
+ * -1, to keep the mode), also set its width from a sample of the rows.
+ */
+static void fix_column_widths(ViewDetails *view_details, int sizing)
+{
+	widen_columns(view_details, sizing, NULL, 0);
+}
+
+/* As fix_column_widths(), but if 'rows' isn't NULL then only the 'n' rows
+ * it lists are sampled, and the fixed widths can only grow.
+ */
+static void widen_columns(ViewDetails *view_details, int sizing,
+			  const gint *rows, gint n)
+{
+	GList *columns, *next;
+
+	columns = gtk_tree_view_get_columns((GtkTreeView *) view_details);
+	for (next = columns; next; next = next->next)
+	{
+		GtkTreeViewColumn *column = (GtkTreeViewColumn *) next->data;
+
+		if (sizing == -1 || sizing == GTK_TREE_VIEW_COLUMN_FIXED)
+			gtk_tree_view_column_set_fixed_width(column,
+				sample_width(view_details, column, rows, n));
+		if (sizing != -1)
+			gtk_tree_view_column_set_sizing(column, sizing);
+	}
+	g_list_free(columns);
+}
+
+/* In fixed mode, columns have fixed widths and rows all have the same
+ * height, so GtkTreeView doesn't measure every row. Used for large lists.
+ */
+static void set_fixed_rows(ViewDetails *view_details, gboolean fixed)
+{
+	GtkTreeView *treeview = (GtkTreeView *) view_details;
+
+	if (view_details->fixed_rows == fixed)
+		return;
+	view_details->fixed_rows = fixed;
+
+	if (fixed)
+	{
+		fix_column_widths(view_details, GTK_TREE_VIEW_COLUMN_FIXED);
+		gtk_tree_view_set_fixed_height_mode(treeview, TRUE);
+	}
+	else
+	{
+		gtk_tree_view_set_fixed_height_mode(treeview, FALSE);
+		fix_column_widths(view_details,
+				  GTK_TREE_VIEW_COLUMN_GROW_ONLY);
+	}
+}
+
+/* Sort 'new_items' (ViewItems) and merge them into the (sorted) list.
+ * Normally, the tree view is told about each one at its final position.
+ * If a large list (see o_display_fixed_rows) is at least doubling in size
+ * (eg, loading a large directory) and nothing is selected, the model is
+ * instead detached and reattached, which is much quicker than millions of
+ * row_inserted signals. This loses the scroll position, so small lists
+ * never do it.
+ */
+static void merge_new_items(ViewDetails *view_details, GPtrArray *new_items)
+{
+	GPtrArray *items = view_details->items;
+	GtkTreeView *treeview = (GtkTreeView *) view_details;
+	GtkTreeModel *model = (GtkTreeModel *) view_details;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	gint i, j, k, n_old = items->len, n_new = new_items->len;
+	gint *new_pos;
+	gboolean reset, was_fixed = view_details->fixed_rows;
+
+	reset = n_new > n_old &&
+		(view_details->fixed_rows ||
+		 (o_display_fixed_rows.int_value > 0 &&
+		  n_new > o_display_fixed_rows.int_value)) &&
+		(n_old == 0 ||
+		 gtk_tree_selection_count_selected_rows(view_details->selection)
+		 == 0);
+	if (reset)
+		gtk_tree_view_set_model(treeview, NULL);
+
+	set_sort_fn(view_details);
+	g_ptr_array_sort_with_data(new_items, (GCompareDataFunc) wrap_sort,
+				   view_details);
+
+	g_ptr_array_set_size(items, n_old + n_new);
+	new_pos = g_new(gint, n_new);
+
+	/* Merge from the end, so that the old items only move once */
+	i = n_old - 1;
+	j = n_new - 1;
+	for (k = n_old + n_new - 1; j >= 0; k--)
+	{
+		if (i >= 0 && wrap_sort(&items->pdata[i], &new_items->pdata[j],
+					view_details) > 0)
+		{
+			if (view_details->wink_item == i)
+				view_details->wink_item = k;
+			items->pdata[k] = items->pdata[i--];
+		}
+		else
+		{
+			items->pdata[k] = new_items->pdata[j];
+			new_pos[j--] = k;
+		}
+	}
+
+	if (o_display_fixed_rows.int_value > 0 &&
+	    items->len > o_display_fixed_rows.int_value)
+		set_fixed_rows(view_details, TRUE);
+
+	/* Large directories arrive in several batches. Make sure the
+	 * fixed-width columns are wide enough for the new items too.
+	 */
+	if (was_fixed)
+		widen_columns(view_details, -1, new_pos, n_new);
+
+	if (reset)
+	{
+		gtk_tree_view_set_model(treeview, model);
+		g_free(new_pos);
+		return;
+	}
+
+	/* In order, so that the rows before each one are as the tree view
+	 * expects.
+	 */
+	for (j = 0; j < n_new; j++)
+	{
+		iter.user_data = GINT_TO_POINTER(new_pos[j]);
+		path = details_get_path(model, &iter);
+		gtk_tree_model_row_inserted(model, path, &iter);
+		gtk_tree_path_free(path);
+	}
+
+	g_free(new_pos);
+}
+
 static void view_details_sort(ViewIface *view)
 {
 	resort((ViewDetails *) view);
@@ -1220,14 +1453,10 @@ static void view_details_add_items(ViewIface *view, GPtrArray *new_items)
 {
 	ViewDetails *view_details = (ViewDetails *) view;
 	FilerWindow *filer_window = view_details->filer_window;
-	GPtrArray *items = view_details->items;
-	GtkTreeIter iter;
+	GPtrArray *batch;
 	int i;
-	GtkTreePath *path;
-	GtkTreeModel *model = (GtkTreeModel *) view;
 
-	iter.user_data = GINT_TO_POINTER(items->len);
-	path = details_get_path(model, &iter);
+	batch = g_ptr_array_sized_new(new_items->len);
 
 	for (i = 0; i < new_items->len; i++)
 	{
@@ -1250,21 +1479,19 @@ static void view_details_add_items(ViewIface *view, GPtrArray *new_items)
 		vitem = g_new(ViewItem, 1);
 		vitem->item = item;
 		vitem->image = NULL;
+		vitem->columns = NULL;
 		if (!g_utf8_validate(leafname, -1, NULL))
 			vitem->utf8_name = to_utf8(leafname);
 		else
 			vitem->utf8_name = NULL;
 		
-		g_ptr_array_add(items, vitem);
-
-		iter.user_data = GINT_TO_POINTER(items->len - 1);
-		gtk_tree_model_row_inserted(model, path, &iter);
-		gtk_tree_path_next(path);
+		g_ptr_array_add(batch, vitem);
 	}
 
-	gtk_tree_path_free(path);
+	if (batch->len)
+		merge_new_items(view_details, batch);
 
-	resort(view_details);
+	g_ptr_array_free(batch, TRUE);
 }
 
 /* Find an item in the sorted array.
@@ -1343,10 +1570,12 @@ static void view_details_update_items(ViewIface *view, GPtrArray *items)
 				g_object_unref(G_OBJECT(view_item->image));
 				view_item->image = NULL;
 			}
+			null_g_free(&view_item->columns);
 			path = gtk_tree_path_new();
 			gtk_tree_path_append_index(path, j);
 			iter.user_data = GINT_TO_POINTER(j);
 			gtk_tree_model_row_changed(model, path, &iter);
+			gtk_tree_path_free(path);
 		}
 	}
 }
@@ -1387,10 +1616,21 @@ static void view_details_delete_if(ViewIface *view,
 
 static void view_details_clear(ViewIface *view)
 {
+	ViewDetails *view_details = (ViewDetails *) view;
 	GtkTreePath *path;
-	GPtrArray *items = ((ViewDetails *) view)->items;
+	GPtrArray *items = view_details->items;
 	GtkTreeModel *model = (GtkTreeModel *) view;
 
+	if (view_details->fixed_rows)
+	{
+		/* Quicker than deleting each row */
+		gtk_tree_view_set_model((GtkTreeView *) view, NULL);
+		g_ptr_array_set_size(items, 0);
+		set_fixed_rows(view_details, FALSE);
+		gtk_tree_view_set_model((GtkTreeView *) view, model);
+		return;
+	}
+
 	path = gtk_tree_path_new();
 	gtk_tree_path_append_index(path, items->len);
 
@@ -1732,6 +1972,35 @@ static void view_details_extend_tip(ViewIface *view,
 {
 }
 
+static void view_details_get_visible_limits(ViewIface *view,
+					    int *first, int *last)
+{
+	GtkTreePath *start, *end;
+
+	if (!gtk_tree_view_get_visible_range((GtkTreeView *) view,
+					     &start, &end))
+	{
+		*first = *last = 0;	/* Not shown yet; top rows first */
+		return;
+	}
+
+	*first = gtk_tree_path_get_indices(start)[0];
+	*last = gtk_tree_path_get_indices(end)[0];
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
+}
+
+/* first and last are row indexes, from view_details_get_visible_limits() */
+static int view_details_visible_distance(ViewIface *view, ViewIter *iter,
+					 int first, int last)
+{
+	if (iter->i < first)
+		return first - iter->i;
+	if (iter->i > last)
+		return iter->i - last;
+	return 0;
+}
+
 static DirItem *iter_init(ViewIter *iter)
 {
 	ViewDetails *view_details = (ViewDetails *) iter->view;
@@ -1901,6 +2170,7 @@ static void free_view_item(ViewItem *view_item)
 	if (view_item->image)
 		g_object_unref(G_OBJECT(view_item->image));
 	g_free(view_item->utf8_name);
+	g_free(view_item->columns);
 	g_free(view_item);
 }
 
@@ -17,6 +17,7 @@ struct _ViewItem {
 	MaskedPixmap *image;
 	int	old_pos;	/* Used while sorting */
 	gchar   *utf8_name;	/* NULL => leafname is valid */
+	gchar	*columns;	/* Cached details text, or NULL */
 };
 
 typedef struct _ViewDetails ViewDetails;
@@ -41,6 +42,8 @@ struct _ViewDetails {
 
 	GtkRequisition desired_size;
 
+	gboolean	fixed_rows;	/* Large list; don't measure rows */
+
 	gboolean	lasso_box;
 	int		lasso_start_index;
 	int		drag_box_x[2];	/* Index 0 is the fixed corner */
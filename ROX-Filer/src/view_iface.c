@@ -412,3 +412,26 @@ gboolean view_auto_scroll_callback(ViewIface *obj)
 	return VIEW_IFACE_GET_CLASS(obj)->auto_scroll_callback(obj);
 }
 
+/* Find which part of the view is visible now, for view_visible_distance().
+ * The limits are only meaningful to the view that returned them, and only
+ * until it is next scrolled or changed.
+ */
+void view_get_visible_limits(ViewIface *obj, int *first, int *last)
+{
+	g_return_if_fail(VIEW_IS_IFACE(obj));
+
+	VIEW_IFACE_GET_CLASS(obj)->get_visible_limits(obj, first, last);
+}
+
+/* How many rows away from the visible part of the window the item last
+ * returned by iter->next() is. 0 if it is (partly) visible now.
+ * first and last come from view_get_visible_limits().
+ */
+int view_visible_distance(ViewIface *obj, ViewIter *iter, int first, int last)
+{
+	g_return_val_if_fail(VIEW_IS_IFACE(obj), 0);
+
+	return VIEW_IFACE_GET_CLASS(obj)->visible_distance(obj, iter,
+							   first, last);
+}
+
@@ -85,6 +85,9 @@ struct _ViewIfaceClass {
 	void (*start_lasso_box)(ViewIface *obj, GdkEventButton *event);
 	void (*extend_tip)(ViewIface *obj, ViewIter *iter, GString *tip);
 	gboolean (*auto_scroll_callback)(ViewIface *obj);
+	void (*get_visible_limits)(ViewIface *obj, int *first, int *last);
+	int (*visible_distance)(ViewIface *obj, ViewIter *iter,
+				int first, int last);
 };
 
 #define VIEW_TYPE_IFACE           (view_iface_get_type())
@@ -143,5 +146,7 @@ void view_set_base(ViewIface *obj, ViewIter *iter);
 void view_start_lasso_box(ViewIface *obj, GdkEventButton *event);
 void view_extend_tip(ViewIface *obj, ViewIter *iter, GString *tip);
 gboolean view_auto_scroll_callback(ViewIface *obj);
+void view_get_visible_limits(ViewIface *obj, int *first, int *last);
+int view_visible_distance(ViewIface *obj, ViewIter *iter, int first, int last);
 
 #endif /* __VIEW_IFACE_H__ */